@@ -0,0 +1,24 @@
+#pragma once
+
+#include <chrono>
+#include <cstdio>
+#include <string>
+
+// runs <fn> <iterations> times and prints the average time per run.
+template<typename Fn>
+auto bench_run(const std::string& name, int iterations, Fn&& fn) -> double {
+	fn(); // warm-up
+	const auto time_start = std::chrono::steady_clock::now();
+	for(int i=0; i<iterations; i++) fn();
+	const auto time_end = std::chrono::steady_clock::now();
+
+	const double usec = std::chrono::duration<double,std::micro>(time_end - time_start).count() / iterations;
+	std::printf("\t%-28s %10.1f us\n",name.c_str(),usec);
+	return usec;
+}
+
+// keeps the compiler from dropping a result that's never read.
+template<typename T>
+auto bench_keep(const T& value) -> void {
+	asm volatile("" : : "g"(&value) : "memory");
+}
@@ -0,0 +1,46 @@
+#include <aya.h>
+#include <random>
+#include "bench.h"
+
+/*
+ * direct-color rows: CColor::write_* per dot, against the aya::pack row
+ * converters, over a 1024x1024 sheet.
+*/
+
+namespace {
+	constexpr int SHEET_DOTS = 1024 * 1024;
+	constexpr int ITERATIONS = 20;
+};
+
+int main() {
+	std::mt19937 rng(0xC010);
+	std::vector<aya::CColor> dots(SHEET_DOTS);
+	for(auto& dot : dots) dot = aya::CColor(rng(),rng(),rng(),rng());
+
+	std::vector<uint8_t> out(SHEET_DOTS * 4);
+	std::printf("color (%d dots):\n",SHEET_DOTS);
+
+	const double rgb565_old = bench_run("rgb565 write_rgb565",ITERATIONS,[&] {
+		scl::blob blob;
+		for(const auto& dot : dots) dot.write_rgb565(blob);
+		bench_keep(blob);
+	});
+	const double rgb565_new = bench_run("rgb565 pack::row_rgb565",ITERATIONS,[&] {
+		aya::pack::row_rgb565(dots.data(),out.data(),dots.size());
+		bench_keep(out);
+	});
+	const double sat_old = bench_run("sat write_rgb5a1_sat",ITERATIONS,[&] {
+		scl::blob blob;
+		for(const auto& dot : dots) dot.write_rgb5a1_sat(blob,true);
+		bench_keep(blob);
+	});
+	const double sat_new = bench_run("sat pack::row_rgb5a1Sat",ITERATIONS,[&] {
+		aya::pack::row_rgb5a1Sat(dots.data(),out.data(),dots.size(),true);
+		bench_keep(out);
+	});
+
+	std::printf("\tspeedup: rgb565 %.1fx, saturn %.1fx\n",
+		rgb565_old/rgb565_new, sat_old/sat_new
+	);
+	return 0;
+}
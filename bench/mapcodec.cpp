@@ -0,0 +1,68 @@
+#include <aya.h>
+#include <random>
+#include "bench.h"
+
+/*
+ * plane-split map packing: aya::mapcodec::encode & decode over a
+ * 256x256 map, laid out like a 10-bit agm map (flips & palettes) and
+ * like a 12-bit ngm one. every map has to come back from decode() as it
+ * went in; encode() doesn't check that itself.
+*/
+
+namespace {
+	constexpr int MAP_W = 256;
+	constexpr int MAP_H = 256;
+	constexpr int ITERATIONS = 20;
+
+	// tiles numbered as they first show up, in runs, like a real map
+	auto map_make(std::mt19937& rng, int index_bits, bool flips) -> std::vector<uint16_t> {
+		std::vector<uint16_t> map(MAP_W * MAP_H);
+		const uint32_t max_index = (1u << index_bits) - 1;
+		uint32_t next_index = 0;
+		uint16_t entry = 0;
+		for(auto& dst : map) {
+			if((rng() % 4) == 0) {
+				uint32_t index = (rng() % 2) ? next_index++ : (rng() % (next_index + 1));
+				index = std::min(index,max_index);
+				const uint32_t flip = flips ? (rng() % 4) : 0;
+				const uint32_t palet = flips ? ((rng() % 8) == 0) : 0;
+				entry = index | (flip << index_bits) | (palet << (index_bits + 2));
+			}
+			dst = entry;
+		}
+		return map;
+	}
+
+	auto round_trip(const char* name, const std::vector<uint16_t>& map, int index_bits) -> bool {
+		for(bool big_endian : {false,true}) {
+			const auto packed = aya::mapcodec::encode(map,MAP_W,big_endian,index_bits);
+			if(aya::mapcodec::decode(packed.data<const uint8_t*>(),packed.size(),big_endian) != map) {
+				std::printf("\t%s: map didn't survive a round trip (%s endian)\n",name,big_endian ? "big" : "little");
+				return false;
+			}
+		}
+		return true;
+	}
+};
+
+int main() {
+	std::mt19937 rng(0xC4A);
+	const auto map_agm = map_make(rng,10,true);
+	const auto map_ngm12 = map_make(rng,12,false);
+
+	std::printf("mapcodec (%dx%d):\n",MAP_W,MAP_H);
+	if(!round_trip("10-bit",map_agm,10) || !round_trip("12-bit",map_ngm12,12)) return 1;
+
+	const auto packed = aya::mapcodec::encode(map_agm,MAP_W,false,10);
+	bench_run("encode 10-bit",ITERATIONS,[&] { bench_keep(aya::mapcodec::encode(map_agm,MAP_W,false,10)); });
+	bench_run("decode 10-bit",ITERATIONS,[&] {
+		bench_keep(aya::mapcodec::decode(packed.data<const uint8_t*>(),packed.size(),false));
+	});
+	bench_run("encode 12-bit",ITERATIONS,[&] { bench_keep(aya::mapcodec::encode(map_ngm12,MAP_W,true,12)); });
+
+	std::printf("\tsize: 10-bit %zu -> %zu bytes, 12-bit %zu -> %zu bytes\n",
+		map_agm.size() * 2,packed.size(),
+		map_ngm12.size() * 2,aya::mapcodec::encode(map_ngm12,MAP_W,true,12).size()
+	);
+	return 0;
+}
@@ -0,0 +1,86 @@
+#include <aya.h>
+#include <random>
+#include "bench.h"
+
+/*
+ * indexed packing: the per-dot loops convert_rawAGI/NGI/HGI used to run,
+ * against the aya::pack row kernels, over a 1024x1024 sheet of pens.
+*/
+
+namespace {
+	constexpr int SHEET_W = 1024;
+	constexpr int SHEET_H = 1024;
+	constexpr int ITERATIONS = 20;
+
+	auto legacy_i4(const std::vector<aya::CColor>& dots) -> scl::blob {
+		scl::blob out;
+		for(int iy=0; iy<SHEET_H; iy++) {
+			for(int ix=0; ix<SHEET_W; ix += 2) {
+				auto dotA = dots.at(ix + iy*SHEET_W).a & 0xF;
+				auto dotB = dots.at(ix+1 + iy*SHEET_W).a & 0xF;
+				out.write_u8(dotA | (dotB<<4));
+			}
+		}
+		return out;
+	}
+	auto legacy_i8(const std::vector<aya::CColor>& dots) -> scl::blob {
+		scl::blob out;
+		for(int iy=0; iy<SHEET_H; iy++) {
+			for(int ix=0; ix<SHEET_W; ix++) {
+				dots.at(ix + iy*SHEET_W).write_alpha(out);
+			}
+		}
+		return out;
+	}
+	auto legacy_i2(const std::vector<aya::CColor>& dots) -> scl::blob {
+		scl::blob out;
+		for(int iy=0; iy<SHEET_H; iy++) {
+			for(int ix=0; ix<SHEET_W; ix += 8) {
+				uint8_t plane0 = 0;
+				uint8_t plane1 = 0;
+				for(int o=0; o<8; o++) {
+					auto dot = dots.at(ix+o + iy*SHEET_W).a & 3;
+					plane0 |= (dot&1) << (7-o);
+					plane1 |= (dot>>1) << (7-o);
+				}
+				out.write_u8(plane0);
+				out.write_u8(plane1);
+			}
+		}
+		return out;
+	}
+};
+
+int main() {
+	std::mt19937 rng(0xA7A);
+	std::vector<aya::CColor> dots(SHEET_W * SHEET_H);
+	for(auto& dot : dots) dot = aya::CColor(rng() & 0xFF);
+
+	std::vector<uint8_t> out(SHEET_W * SHEET_H);
+	std::printf("pack (%dx%d):\n",SHEET_W,SHEET_H);
+
+	const double i8_old = bench_run("i8 legacy",ITERATIONS,[&] { bench_keep(legacy_i8(dots)); });
+	const double i8_new = bench_run("i8 pack::row_i8",ITERATIONS,[&] {
+		aya::pack::row_i8(dots.data(),out.data(),dots.size());
+		bench_keep(out);
+	});
+	const double i4_old = bench_run("i4 legacy",ITERATIONS,[&] { bench_keep(legacy_i4(dots)); });
+	const double i4_new = bench_run("i4 pack::row_i4",ITERATIONS,[&] {
+		for(int iy=0; iy<SHEET_H; iy++) {
+			aya::pack::row_i4(&dots[iy*SHEET_W],&out[iy*SHEET_W/2],SHEET_W,true);
+		}
+		bench_keep(out);
+	});
+	const double i2_old = bench_run("i2 legacy",ITERATIONS,[&] { bench_keep(legacy_i2(dots)); });
+	const double i2_new = bench_run("i2 pack::row_i2planar",ITERATIONS,[&] {
+		for(int iy=0; iy<SHEET_H; iy++) {
+			aya::pack::row_i2planar(&dots[iy*SHEET_W],&out[iy*SHEET_W/4],SHEET_W);
+		}
+		bench_keep(out);
+	});
+
+	std::printf("\tspeedup: i8 %.1fx, i4 %.1fx, i2 %.1fx\n",
+		i8_old/i8_new, i4_old/i4_new, i2_old/i2_new
+	);
+	return 0;
+}
@@ -16,6 +16,7 @@ class CArgParser {
 		auto arg_find(std::string name,int len = 0) -> int;
 		auto arg_isValid(std::string name, int len = 0) -> bool;
 		auto arg_get(std::string name, int len = 0) -> std::vector<std::string>;
+		auto arg_getAll(std::string name, int len = 0) -> std::vector<std::vector<std::string>>;
 		auto size() const -> int { return m_arglist.size(); }
 		auto has_arguments() const -> bool { return size() > 0; }
 };
@@ -3,10 +3,14 @@
 #define SCL_USE_ZLIB
 #include <scl/container/blob.hpp>
 #include <string>
+#include <cstdio>
+#include <vector>
 #include <memory>
 #include <array>
 #include <map>
 #include <optional>
+#include <thread>
+#include <algorithm>
 
 namespace aya {
 	class CPhoto;
@@ -23,6 +27,16 @@ namespace aya {
 	class CEdgeAnimPart;
 	class CKmapJSON;
 	class CKmapJSONTile;
+	class CTileDedupTable;
+	class CTileOccupancy;
+	class CTileKeyList;
+	class CTileMerger;
+	class CCelOrder;
+	class CMetatileTable;
+	struct CPNGInfo;
+	class CPNGBandReader;
+	class CPixelWriter;
+	class CVQCodebook;
 
 	template<typename Type> class basic_array2d;
 
@@ -47,6 +61,51 @@ namespace aya {
 	struct HOURAI_HGIFILE_HEADER;
 	struct HOURAI_HGMFILE_HEADER;
 
+	namespace pixfmt {
+		enum class Encoding { Index, RGB565, RGB5A1, ARGB4, ARGB8, RGB5A1Sat, RGB5A1Agb };
+		enum class NibbleOrder { LowFirst, HighFirst };
+		enum class Endian { Little, Big };
+		enum class Layout { Linear, Planar };
+
+		// compile-time description of one pixel format
+		template<Encoding Enc, int Bpp, NibbleOrder Nib = NibbleOrder::LowFirst,
+			Endian End = Endian::Little, Layout Lay = Layout::Linear>
+		struct CTraits {
+			static constexpr Encoding encoding = Enc;
+			static constexpr int bpp = Bpp;
+			static constexpr NibbleOrder nibble_order = Nib;
+			static constexpr Endian endian = End;
+			static constexpr Layout layout = Lay;
+			static constexpr bool is_indexed = (Enc == Encoding::Index);
+		};
+
+		// a platform's formats, in the same order as its format ids
+		template<typename... Formats>
+		struct CFormatList {
+			static constexpr int len = sizeof...(Formats);
+			static constexpr std::array<int,len> bpp = { Formats::bpp... };
+
+			// calls fn(traits) with format <id>'s traits, once per image;
+			// returns false if there's no such format.
+			template<typename Fn>
+			static auto visit(int id, Fn&& fn) -> bool {
+				int index = 0;
+				return ((index++ == id ? (fn(Formats{}), true) : false) || ...);
+			}
+		};
+
+		using i2gb = CTraits<Encoding::Index,2,NibbleOrder::HighFirst,Endian::Little,Layout::Planar>;
+		using i4lo = CTraits<Encoding::Index,4,NibbleOrder::LowFirst>;
+		using i4hi = CTraits<Encoding::Index,4,NibbleOrder::HighFirst>;
+		using i8 = CTraits<Encoding::Index,8>;
+		using rgb565 = CTraits<Encoding::RGB565,16>;
+		using rgb5a1 = CTraits<Encoding::RGB5A1,16>;
+		using argb4 = CTraits<Encoding::ARGB4,16>;
+		using argb8 = CTraits<Encoding::ARGB8,32>;
+		using rgb5a1sat = CTraits<Encoding::RGB5A1Sat,16,NibbleOrder::LowFirst,Endian::Big>;
+		using rgb5a1agb = CTraits<Encoding::RGB5A1Agb,16>;
+	};
+
 	namespace patchu_graphfmt {
 		enum {
 			i4,
@@ -59,6 +118,8 @@ namespace aya {
 			invalid = 0xFF,
 			strided = (1<<9)
 		};
+		using formats = pixfmt::CFormatList<pixfmt::i4lo,pixfmt::i8,pixfmt::rgb565,pixfmt::rgb5a1,pixfmt::argb4,pixfmt::argb8>;
+		static_assert(formats::len == len);
 		auto getBPP(int format) -> int;
 		constexpr auto getID(int format) -> int { return format & 0xFF; }
 		constexpr auto isValid(int format) -> bool {
@@ -76,18 +137,37 @@ namespace aya {
 			len,
 			invalid = 0xFF,
 			nontwiddled = (1<<8),
-			strided = (1<<9)
+			strided = (1<<9),
+			vq = (1<<10),
+			mipmapped = (1<<11)
 		};
+		// bytes before the 1x1 level of a mipmapped 16-bit texture
+		constexpr int MIPMAP_PAD_16BPP = 6;
+		// strided widths are multiples of 32, up to 31*32
+		constexpr int STRIDE_ALIGN = 32;
+		constexpr int STRIDE_MAX = 992;
+		using formats = pixfmt::CFormatList<pixfmt::i4lo,pixfmt::i8,pixfmt::rgb565,pixfmt::rgb5a1,pixfmt::argb4>;
+		static_assert(formats::len == len);
 		auto getBPP(int format) -> int;
 		constexpr auto getID(int format) -> int { return format & 0xFF; }
 		constexpr auto isTwiddled(int format) -> bool { return (format & nontwiddled) == 0; }
+		constexpr auto isVQ(int format) -> bool { return (format & vq) != 0; }
+		constexpr auto isMipmapped(int format) -> bool { return (format & mipmapped) != 0; }
+		constexpr auto isStrided(int format) -> bool { return (format & strided) != 0; }
 		constexpr auto isValid(int format) -> bool {
 			auto id = getID(format);
 			return (id >= 0) && (id < len);
 		}
 	};
 	namespace narumi_graphfmt {
-		enum { i4,i8,rgb,len };
+		enum {
+			i4,i8,rgb,len,
+			metatiled = (1<<9), // map section holds metatiles, then a map of them
+			chunked = (1<<10),  // map is cut into separately compressed chunks
+			packed = (1<<11),   // map (or each chunk) is in aya::mapcodec's format
+		};
+		using formats = pixfmt::CFormatList<pixfmt::i4hi,pixfmt::i8,pixfmt::rgb5a1sat>;
+		static_assert(formats::len == len);
 		auto getBPP(int format) -> int;
 		constexpr auto getID(int format) -> int { return format & 0xFF; }
 		constexpr auto isValid(int format) -> bool {
@@ -99,7 +179,12 @@ namespace aya {
 		enum {
 			i4,i8,rgb,len,
 			compressed = (1<<8),
+			metatiled = (1<<9), // map section holds metatiles, then a map of them
+			chunked = (1<<10),  // map is cut into separately compressed chunks
+			packed = (1<<11),   // map (or each chunk) is in aya::mapcodec's format
 		};
+		using formats = pixfmt::CFormatList<pixfmt::i4lo,pixfmt::i8,pixfmt::rgb5a1agb>;
+		static_assert(formats::len == len);
 		auto getBPP(int format) -> int;
 		constexpr auto getID(int format) -> int { return format & 0xFF; }
 		constexpr auto isValid(int format) -> bool {
@@ -109,6 +194,8 @@ namespace aya {
 	};
 	namespace hourai_graphfmt {
 		enum { i2,len };
+		using formats = pixfmt::CFormatList<pixfmt::i2gb>;
+		static_assert(formats::len == len);
 		auto getBPP(int format) -> int;
 		constexpr auto getID(int format) -> int { return format & 0xFF; }
 		constexpr auto isValid(int format) -> bool {
@@ -136,6 +223,11 @@ namespace aya {
 		int format;
 		int is_12bit;
 		bool verbose;
+		bool merge_cels; // lossily merge similar cels if over the limit
+		bool reorder_cels; // put alike cels together, to compress better
+		int metatile_sizeX,metatile_sizeY; // 0 for a plain map
+		int map_chunkX,map_chunkY; // 0x0 for one flat map
+		bool map_packed; // store the map (or chunks) with aya::mapcodec
 	};
 	struct CAliceAGAConvertInfo {
 		std::string filename_json;
@@ -174,6 +266,12 @@ namespace aya {
 		bool ignore_cel;
 		bool ignore_map;
 		bool ignore_palet;
+		bool merge_cels;
+		bool reorder_cels;
+		bool subpalettes; // pick each cel's 16-color bank from its pens
+		int metatile_sizeX,metatile_sizeY;
+		int map_chunkX,map_chunkY;
+		bool map_packed;
 	};
 	struct CHouraiHGIConvertInfo {
 		bool do_compress;
@@ -186,6 +284,9 @@ namespace aya {
 		bool do_compress;
 		int format;
 		bool verbose;
+		bool merge_cels;
+		bool reorder_cels;
+		bool gbc; // spill into vram bank 1, & take cgb palettes from pens
 	};
 	struct CWorkingFrameCreateInfo {
 		public:
@@ -198,12 +299,63 @@ namespace aya {
 	auto convert_fileAGE(const std::string& filename_xml, const CAliceAGEConvertInfo &info) -> scl::blob;
 
 	auto conv_po2(int n) -> int;
+	auto tilekey_size(int width, int height, int bpp) -> size_t;
 	auto compress(scl::blob& srcblob, bool do_compress = true) -> scl::blob;
 	auto compress_spd(scl::blob& srcblob, bool do_compress = true) -> scl::blob;
+	auto png_encodeIndexed(const std::vector<uint8_t>& indices, int width, int height,
+		const std::array<aya::CColor,256>& palette
+	) -> std::vector<uint8_t>;
 	auto twiddled_index(int x, int y, int w, int h) -> size_t;
 	auto twiddled_index4b(int x, int y, int w, int h) -> size_t;
+	auto twiddled_rowIndices(int y, int w, int h, size_t* indices) -> void;
 	namespace util {
 		auto version_get() -> CAyaVersion;
+		auto thread_count() -> int;
+
+		// calls fn(begin,end) over [0,count), split into one contiguous
+		// range per thread. returns once every range is done.
+		template<typename Fn> auto parallel_for(size_t count, Fn&& fn) -> void {
+			const size_t num_threads = std::min<size_t>(thread_count(),count);
+			if(num_threads <= 1) {
+				if(count > 0) fn(size_t(0),count);
+				return;
+			}
+			std::vector<std::thread> threads;
+			threads.reserve(num_threads);
+			for(size_t t=0; t<num_threads; t++) {
+				const size_t begin = (count * t) / num_threads;
+				const size_t end = (count * (t+1)) / num_threads;
+				threads.emplace_back([&fn,begin,end]() { fn(begin,end); });
+			}
+			for(auto& thread : threads) thread.join();
+		}
+	};
+
+	namespace pack {
+		// packs a row of dots' pen numbers for the indexed formats. rows
+		// ending in a partial byte are padded out with pen 0.
+		auto row_i8(const aya::CColor* dots, uint8_t* out, size_t len) -> void;
+		auto row_i4(const aya::CColor* dots, uint8_t* out, size_t len, bool low_first) -> void;
+		auto row_i2planar(const aya::CColor* dots, uint8_t* out, size_t len) -> void; // gb 2bpp
+
+		// direct-color rows, 2 bytes per dot (4 for argb8); see the
+		// matching CColor::write_* functions for each format.
+		auto row_rgb565(const aya::CColor* dots, uint8_t* out, size_t len) -> void;
+		auto row_rgb5a1(const aya::CColor* dots, uint8_t* out, size_t len, int test = 254) -> void;
+		auto row_argb4(const aya::CColor* dots, uint8_t* out, size_t len) -> void;
+		auto row_argb8(const aya::CColor* dots, uint8_t* out, size_t len) -> void;
+		auto row_rgb5a1Sat(const aya::CColor* dots, uint8_t* out, size_t len, bool msb) -> void;
+		auto row_rgb5a1Agb(const aya::CColor* dots, uint8_t* out, size_t len) -> void;
+	};
+
+	namespace mapcodec {
+		// packs a map of 16-bit entries (tile index in the low <index_bits>
+		// bits, 2 flip bits above it, palette in the rest) by splitting
+		// those into separate delta & run-length coded streams; see
+		// mapcodec.cpp. decode() is the reference for what the target has
+		// to do; it reads <index_bits> back from the stream's header.
+		auto encode(const std::vector<uint16_t>& map, int map_width, bool big_endian, int index_bits = 10) -> scl::blob;
+		auto decode(const uint8_t* data, size_t size, bool big_endian) -> std::vector<uint16_t>;
 	};
 
 	namespace AGBShape {
@@ -214,6 +366,16 @@ namespace aya {
 		};
 	};
 
+	namespace PNGColorType {
+		enum {
+			Gray = 0,
+			RGB = 2,
+			Palette = 3,
+			GrayAlpha = 4,
+			RGBA = 6
+		};
+	};
+
 	namespace ImgFlip {
 		enum {
 			None = 0,
@@ -597,6 +759,8 @@ class aya::CPhoto {
 		
 		auto hash_get(int flip) const -> uint64_t;
 		auto hash_getIndexed(int flip) const -> uint64_t;
+		auto key_get(int flip, int bpp) const -> std::vector<uint8_t>;
+		auto palet_getBank(int bank_size, bool skip_pen0 = true) const -> int;
 
 		auto convert_fileHGI(const CHouraiHGIConvertInfo &info) -> scl::blob;
 		auto convert_fileHGM(const CHouraiHGMConvertInfo &info) -> scl::blob;
@@ -604,7 +768,10 @@ class aya::CPhoto {
 		auto convert_fileAGI(const CAliceAGIConvertInfo &info) -> scl::blob;
 		auto convert_fileAGM(const CAliceAGMConvertInfo &info) -> scl::blob;
 		auto convert_fileKMPtoAGM(const CAliceAGMConvertInfo &info) -> scl::blob;
-		auto convert_fileMGI(int format, bool do_compress = true) -> scl::blob;
+		// one .AGM per kmap layer (every layer, if <layers> is empty); all
+		// of them share the first one's cels.
+		auto convert_fileKMPtoAGMLayers(const CAliceAGMConvertInfo &info, const std::vector<int>& layers) -> std::vector<scl::blob>;
+		auto convert_fileMGI(int format, bool do_compress = true, bool vq_preview = false) -> scl::blob;
 		auto convert_filePGI(int format, bool do_compress = true) -> scl::blob;
 		auto convert_filePGA(int format, const std::string& json_filename, bool do_compress = true) -> scl::blob;
 		auto convert_fileNGA(const CNarumiNGAConvertInfo &info) -> scl::blob;
@@ -616,9 +783,21 @@ class aya::CPhoto {
 		auto convert_rawPGI(int format) const -> scl::blob;
 		auto convert_rawNGI(int format) const -> scl::blob;
 		auto convert_twiddled(int format) const -> scl::blob;
+		auto convert_twiddledVQ(int format, bool preview) const -> scl::blob;
+		auto convert_twiddledMipmaps(int format) const -> scl::blob;
 
 		auto convert_pngIndexed() -> scl::blob;
 
+		// like convert_fileXGM, but with one cel table for all of <pics>;
+		// returns a file for each, with the shared cels in the first one.
+		static auto convert_fileAGMShared(const std::vector<CPhoto*>& pics, const CAliceAGMConvertInfo &info) -> std::vector<scl::blob>;
+		static auto convert_fileHGMShared(const std::vector<CPhoto*>& pics, const CHouraiHGMConvertInfo &info) -> std::vector<scl::blob>;
+		static auto convert_fileNGMShared(const std::vector<CPhoto*>& pics, const CNarumiNGMConvertInfo &info) -> std::vector<scl::blob>;
+
+		// like CPhoto(filename,paletted), but reuses decoded pixels cached
+		// in <cache_dir> from an earlier run on the same file contents.
+		static auto file_loadCached(const std::string& filename, bool paletted, const std::string& cache_dir) -> CPhoto;
+
 		CPhoto();
 		CPhoto(const CPhoto& orig);
 		CPhoto(std::string filename,bool paletted = false, bool opaque_pal=false);
@@ -626,6 +805,120 @@ class aya::CPhoto {
 		~CPhoto();
 };
 
+struct aya::CPNGInfo {
+	// colortype & bitdepth are the png's own (see aya::PNGColorType)
+	int width,height;
+	int bitdepth;
+	int colortype;
+	bool interlaced;
+	int palettesize;
+	std::array<aya::CColor,256> palette; // alpha taken from tRNS
+	bool key_defined; // tRNS color key, for gray/rgb images
+	uint16_t key_r,key_g,key_b;
+
+	auto dot_bits() const -> int;
+	auto row_stride() const -> size_t { return (size_t(width) * dot_bits() + 7) / 8; }
+
+	CPNGInfo() : width(0),height(0),bitdepth(0),colortype(0),interlaced(false),
+		palettesize(0),palette(),key_defined(false),key_r(0),key_g(0),key_b(0) {}
+};
+
+class aya::CPNGBandReader {
+	/*
+	 * reads a png straight from the file, inflating & unfiltering a band
+	 * of scanlines at a time. only the band, one previous scanline, and
+	 * a small input buffer are kept in memory, never the whole file or
+	 * the whole decoded image. interlaced pngs can't be read in order
+	 * this way; is_streamable() is false for them.
+	*/
+	private:
+		struct CInflateState;
+
+		std::FILE *m_file;
+		std::string m_filename;
+		aya::CPNGInfo m_info;
+		std::unique_ptr<CInflateState> m_inflate;
+		uint32_t m_idatLeft;
+		bool m_idatDone;
+		int m_rowsRead;
+		std::vector<uint8_t> m_rowPrev; // filter byte + unfiltered scanline
+		std::vector<uint8_t> m_rowCur;
+
+		auto chunk_readHeader(uint32_t& length, std::array<char,4>& type) -> bool;
+		auto input_refill() -> bool;
+		auto row_inflate(uint8_t* out, size_t size) -> void;
+		auto row_unfilter() -> void;
+
+	public:
+		auto info() const -> const aya::CPNGInfo& { return m_info; }
+		auto is_streamable() const -> bool { return !m_info.interlaced; }
+		auto rows_left() const -> int { return m_info.height - m_rowsRead; }
+
+		// reads up to <max_rows> scanlines into <band>, packed at
+		// info().row_stride() bytes each. returns the number read.
+		auto band_read(std::vector<uint8_t>& band, int max_rows) -> int;
+
+		CPNGBandReader(const std::string& filename);
+		CPNGBandReader(const CPNGBandReader&) = delete;
+		~CPNGBandReader();
+};
+
+class aya::CPixelWriter {
+	/*
+	 * output buffer for a raw pixel converter. the exact size is known from
+	 * the format's bpp & the image size, so it's allocated once up front,
+	 * and packers write whole rows straight into it.
+	*/
+	private:
+		size_t m_stride;
+		std::vector<uint8_t> m_buffer;
+
+	public:
+		// bytes per row. planar formats (gb 2bpp) store 8 dots in <bpp> bytes.
+		static constexpr auto stride_get(int bpp, int width, bool planar = false) -> size_t {
+			if(planar) return ((size_t(width) + 7) / 8) * bpp;
+			return (size_t(width) * bpp + 7) / 8;
+		}
+
+		auto stride() const -> size_t { return m_stride; }
+		auto size() const -> size_t { return m_buffer.size(); }
+		auto data() -> uint8_t* { return m_buffer.data(); }
+		auto row_get(int y) -> uint8_t* { return m_buffer.data() + (y * m_stride); }
+		auto blob_get() const -> scl::blob { return scl::blob(m_buffer); }
+
+		CPixelWriter(int bpp, int width, int height, bool planar = false) :
+			m_stride(stride_get(bpp,width,planar)),
+			m_buffer(m_stride * height) {}
+		~CPixelWriter() {}
+};
+
+class aya::CVQCodebook {
+	/*
+	 * codebook for pvr vq textures: 256 entries of 2x2 dots, trained with
+	 * k-means over the source blocks. a block's 4 dots are in twiddled
+	 * order: top-left, bottom-left, top-right, bottom-right.
+	 * training is deterministic; the same blocks always give the same
+	 * codebook, whatever the thread count.
+	*/
+	public:
+		static constexpr size_t SIZE = 256;
+		static constexpr int ITERATIONS = 32;
+		static constexpr int ITERATIONS_PREVIEW = 4;
+		using block_t = std::array<aya::CColor,4>;
+
+	private:
+		std::array<block_t,SIZE> m_entries;
+		std::vector<uint8_t> m_indices;
+
+	public:
+		auto entry_get(size_t index) const -> const block_t& { return m_entries.at(index); }
+		// codebook entry for each source block, in the same order
+		auto indices() const -> const std::vector<uint8_t>& { return m_indices; }
+
+		CVQCodebook(const std::vector<block_t>& blocks, int iterations);
+		~CVQCodebook() {}
+};
+
 class aya::CWorkingSubframe {
 	private:
 		aya::CPhoto m_photo;
@@ -687,6 +980,196 @@ class aya::CAGBSubframeList {
 		~CAGBSubframeList() {}
 };
 
+class aya::CTileDedupTable {
+	/*
+	 * flat open-addressing table, keyed by a tile's packed pixel data.
+	 * every key has the same size (e.g 32 bytes for an 8x8 4bpp tile), and
+	 * a lookup only hits when the whole key matches, so two different tiles
+	 * can never get merged due to a hash collision.
+	*/
+	private:
+		size_t m_keySize;
+		size_t m_slotMask;
+		std::vector<uint32_t> m_slots; // entry index + 1, 0 if slot's free
+		std::vector<uint64_t> m_hashes;
+		std::vector<uint8_t> m_keys;
+		std::vector<size_t> m_values;
+
+		auto slot_find(const uint8_t* key, uint64_t hash) const -> size_t;
+		auto slot_grow() -> void;
+		auto key_assert(const std::vector<uint8_t>& key) const -> void;
+
+	public:
+		static auto key_hash(const uint8_t* key, size_t key_size) -> uint64_t;
+
+		auto key_size() const -> size_t { return m_keySize; }
+		auto size() const -> size_t { return m_values.size(); }
+
+		auto find(const std::vector<uint8_t>& key) const -> std::optional<size_t>;
+		auto insert(const std::vector<uint8_t>& key, size_t value) -> bool;
+		// same as above, for keys already hashed with key_hash()
+		auto find(const uint8_t* key, uint64_t hash) const -> std::optional<size_t>;
+		auto insert(const uint8_t* key, uint64_t hash, size_t value) -> bool;
+
+		CTileDedupTable(size_t key_size, size_t capacity = 0);
+		~CTileDedupTable() {}
+};
+
+class aya::CTileKeyList {
+	/*
+	 * dedup keys (& their hashes) for every flip of every tile in a list,
+	 * all made up front across every thread. the tilemap converters then
+	 * only have to walk the tiles in order and look each one up, so the
+	 * first occurrence of a tile still decides its index.
+	*/
+	private:
+		size_t m_keySize;
+		int m_numFlips;
+		std::vector<uint8_t> m_keys;
+		std::vector<uint64_t> m_hashes;
+
+	public:
+		auto key_size() const -> size_t { return m_keySize; }
+		auto size() const -> size_t { return m_hashes.size() / m_numFlips; }
+		auto key_get(size_t tile, int flip) const -> const uint8_t* {
+			return m_keys.data() + ((tile * m_numFlips) + flip) * m_keySize;
+		}
+		auto hash_get(size_t tile, int flip) const -> uint64_t {
+			return m_hashes[(tile * m_numFlips) + flip];
+		}
+
+		CTileKeyList(const std::vector<std::shared_ptr<CPhoto>>& tiles, int bpp, int num_flips = 4);
+		~CTileKeyList() {}
+};
+
+class aya::CTileMerger {
+	/*
+	 * lossy fallback for maps with more unique tiles than the hardware has
+	 * room for. exact duplicates (flips included) are grouped first; then,
+	 * until few enough groups are left, the one that's cheapest to lose is
+	 * merged into its nearest neighbor (under any flip). a merge costs the
+	 * squared argb difference of every dot, looked up through the palette
+	 * for indexed tiles, times how many tiles use the group. neighbors are
+	 * picked by a small signature of each tile (on a vantage-point tree),
+	 * then compared dot by dot; each group keeps a short list of them.
+	*/
+	public:
+		struct CMerge {
+			size_t tile;  // first tile of the merged group
+			size_t into;  // first tile of the group it now uses
+			int flip;     // tile ~= flip(into)
+			double error; // summed over all of the group's tiles
+		};
+
+	private:
+		std::vector<CMerge> m_merges;
+		double m_totalError;
+		size_t m_numUnique;
+		size_t m_numValues; // dot channels in the whole map
+
+	public:
+		auto merges() const -> const std::vector<CMerge>& { return m_merges; }
+		auto total_error() const -> double { return m_totalError; }
+		// prints a summary if anything was merged; every merge if <verbose>.
+		// tiles are located by their index, <tiles_perRow> to a row (or
+		// just shown by index, if that's 0).
+		auto report_print(int tiles_perRow, int tile_w, int tile_h, bool verbose) const -> void;
+
+		// swaps merged tiles in <tiles> for (flipped) copies of the tiles
+		// they now use, so exact dedup then finds at most <budget>.
+		// <tile_banks> is each tile's palette bank (of 2^bpp colors), if
+		// it has one; tiles are shown in their own bank whatever they use.
+		CTileMerger(std::vector<std::shared_ptr<aya::CPhoto>>& tiles, int bpp, int num_flips, size_t budget,
+			const std::array<aya::CColor,256>& palette, const std::vector<int>& tile_banks = {}
+		);
+		~CTileMerger() {}
+};
+
+class aya::CCelOrder {
+	/*
+	 * order for a map's unique cels that puts alike ones next to each
+	 * other, so the bitmap section compresses better. it's a greedy
+	 * nearest-neighbor walk, where the distance between two cels is how
+	 * many bytes of their (unflipped) keys differ.
+	*/
+	private:
+		std::vector<size_t> m_order;    // new index -> old index
+		std::vector<size_t> m_newIndex; // old index -> new index
+
+	public:
+		auto order() const -> const std::vector<size_t>& { return m_order; }
+		auto index_get(size_t cel) const -> size_t { return m_newIndex[cel]; }
+
+		// <cels> are each unique cel's tile index in <keys>, in the
+		// order they were found.
+		CCelOrder(const CTileKeyList& keys, const std::vector<size_t>& cels);
+		~CCelOrder() {}
+};
+
+class aya::CMetatileTable {
+	/*
+	 * splits a map into blocks (metatiles) of <width>x<height> entries,
+	 * and keeps one copy of each, flips included. a flipped block is the
+	 * block mirrored, with the flip bits of each of its entries toggled,
+	 * so it expands just like a flipped tile. a block that uses one
+	 * palette throughout has it lifted out into its metatile map entry,
+	 * so blocks that only differ in palette are kept once.
+	*/
+	private:
+		int m_width,m_height;       // of a metatile, in map entries
+		int m_mapWidth,m_mapHeight; // in metatiles
+		std::vector<uint16_t> m_table; // each metatile's entries, row by row
+		std::vector<uint16_t> m_map;   // id | flip<<10 | palette<<12
+
+	public:
+		auto count() const -> size_t { return m_table.size() / (size_t(m_width) * m_height); }
+		auto table() const -> const std::vector<uint16_t>& { return m_table; }
+		auto map() const -> const std::vector<uint16_t>& { return m_map; }
+		auto map_width() const -> int { return m_mapWidth; }
+		auto map_height() const -> int { return m_mapHeight; }
+
+		// <num_flips> is 1 if the map's entries have no flip bits.
+		// palettes (bits 12-15) are only lifted out if <lift_palet>.
+		CMetatileTable(const std::vector<uint16_t>& map, int map_width, int width, int height,
+			int num_flips, bool lift_palet
+		);
+		~CMetatileTable() {}
+};
+
+class aya::CTileOccupancy {
+	/*
+	 * a bitmap of which tiles in an image have any non-empty dots, built
+	 * once per image. a summed-area table over it answers "how many used
+	 * tiles are in this rect" in O(1).
+	*/
+	private:
+		int m_tileW,m_tileH;
+		int m_gridW,m_gridH;
+		std::vector<uint64_t> m_bitmap;
+		std::vector<uint32_t> m_sat; // (grid w+1) * (grid h+1)
+
+		auto sat_get(int x, int y) const -> uint32_t {
+			return m_sat[x + y * (m_gridW+1)];
+		}
+
+	public:
+		constexpr auto grid_width() const -> int { return m_gridW; }
+		constexpr auto grid_height() const -> int { return m_gridH; }
+		constexpr auto tile_width() const -> int { return m_tileW; }
+		constexpr auto tile_height() const -> int { return m_tileH; }
+
+		auto tile_isEmpty(int x, int y) const -> bool;
+		auto rect_countUsed(int x, int y, int w, int h) const -> int;
+		auto rect_isEmpty(int x, int y, int w, int h) const -> bool {
+			return rect_countUsed(x,y,w,h) == 0;
+		}
+		auto all_empty() const -> bool { return rect_isEmpty(0,0,m_gridW,m_gridH); }
+
+		CTileOccupancy();
+		CTileOccupancy(const CPhoto& photo, int tile_w = 8, int tile_h = 8);
+		~CTileOccupancy() {}
+};
+
 class aya::CKmapJSONTile {
 	private:
 
@@ -40,4 +40,17 @@ auto CArgParser::arg_get(std::string name, int len) -> std::vector<std::string>
 	}
 	return data;
 }
+auto CArgParser::arg_getAll(std::string name, int len) -> std::vector<std::vector<std::string>> {
+	// like arg_get, but for arguments that can be given more than once
+	std::vector<std::vector<std::string>> all_data;
+	for(int i=0; i+len<size(); i++) {
+		if(m_arglist[i] != name) continue;
+		std::vector<std::string> data;
+		for(int a=0; a<=len; a++) {
+			data.push_back(m_arglist[i+a]);
+		}
+		all_data.push_back(data);
+	}
+	return all_data;
+}
 
@@ -0,0 +1,57 @@
+#include <aya.h>
+#include <algorithm>
+#include <limits>
+
+namespace {
+	// bytes that differ between two keys; keys are packed like the cels
+	// themselves, so this is roughly what a compressor sees.
+	auto key_distance(const uint8_t* key_a, const uint8_t* key_b, size_t key_size) -> uint16_t {
+		size_t dist = 0;
+		for(size_t i=0; i<key_size; i++) {
+			dist += key_a[i] != key_b[i];
+		}
+		return std::min<size_t>(dist,std::numeric_limits<uint16_t>::max());
+	}
+};
+
+aya::CCelOrder::CCelOrder(const aya::CTileKeyList& keys, const std::vector<size_t>& cels)
+	: m_order(),m_newIndex(cels.size())
+{
+	const size_t num_cels = cels.size();
+	if(num_cels == 0) return;
+
+	// distances between every pair (on all threads) ----@/
+	std::vector<uint16_t> distances(num_cels * num_cels);
+	aya::util::parallel_for(num_cels,[&](size_t begin, size_t end) {
+		for(size_t a=begin; a<end; a++) {
+			const uint8_t *key_a = keys.key_get(cels[a],0);
+			for(size_t b=0; b<num_cels; b++) {
+				distances[(a * num_cels) + b] = key_distance(key_a,keys.key_get(cels[b],0),keys.key_size());
+			}
+		}
+	});
+
+	// greedy walk --------------------------------------@/
+	// the first cel stays first (maps tend to expect the blank one
+	// there); after that, always go to the nearest cel not yet used.
+	// ties go to the earliest cel, so alike runs keep their order.
+	std::vector<bool> used(num_cels,false);
+	size_t cur = 0;
+	used[cur] = true;
+	m_order.push_back(cur);
+	while(m_order.size() < num_cels) {
+		const uint16_t *row = distances.data() + (cur * num_cels);
+		size_t best = num_cels;
+		for(size_t c=0; c<num_cels; c++) {
+			if(used[c]) continue;
+			if(best == num_cels || row[c] < row[best]) best = c;
+		}
+		used[best] = true;
+		m_order.push_back(best);
+		cur = best;
+	}
+
+	for(size_t i=0; i<num_cels; i++) {
+		m_newIndex[m_order[i]] = i;
+	}
+}
@@ -1,4 +1,9 @@
 #include <aya.h>
+#include <cstring>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 namespace aya {
 	void CColor::write_alpha(scl::blob& out_blob) const {
@@ -57,3 +62,146 @@ namespace aya {
 	}
 }
 
+/*
+ * batch versions of the CColor::write_* functions, for whole rows. in
+ * memory a CColor is a,r,g,b, so loaded as a little-endian word it's
+ * a | r<<8 | g<<16 | b<<24; every format below is a few shifts & masks of
+ * that word, 4 dots per SSE2 register.
+*/
+namespace {
+#if defined(__SSE2__)
+	// packs 8 words' low halves into 8 shorts, without packs' saturation
+	inline auto shorts_pack(__m128i lo, __m128i hi) -> __m128i {
+		lo = _mm_srai_epi32(_mm_slli_epi32(lo,16),16);
+		hi = _mm_srai_epi32(_mm_slli_epi32(hi,16),16);
+		return _mm_packs_epi32(lo,hi);
+	}
+	inline auto shorts_swap(__m128i v) -> __m128i {
+		return _mm_or_si128(_mm_slli_epi16(v,8),_mm_srli_epi16(v,8));
+	}
+	inline auto bits_get(__m128i v, int shift, uint32_t mask) -> __m128i {
+		return _mm_and_si128(_mm_srli_epi32(v,shift),_mm_set1_epi32(mask));
+	}
+
+	// runs <fn> over 8 dots at a time, storing 8 shorts (byteswapped if
+	// <big_endian>); returns how many dots were done.
+	template<typename Fn>
+	auto rows_convert16(const aya::CColor* dots, uint8_t* out, size_t len, bool big_endian, Fn&& fn) -> size_t {
+		size_t i = 0;
+		for(; i+8 <= len; i += 8) {
+			const __m128i *src = reinterpret_cast<const __m128i*>(dots + i);
+			const __m128i lo = fn(_mm_loadu_si128(src + 0));
+			const __m128i hi = fn(_mm_loadu_si128(src + 1));
+			__m128i shorts = shorts_pack(lo,hi);
+			if(big_endian) shorts = shorts_swap(shorts);
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(out + i*2),shorts);
+		}
+		return i;
+	}
+#endif
+
+	inline auto short_write(uint8_t* out, uint16_t num, bool big_endian) -> void {
+		out[0] = big_endian ? (num>>8) : num;
+		out[1] = big_endian ? num : (num>>8);
+	}
+};
+
+auto aya::pack::row_rgb565(const aya::CColor* dots, uint8_t* out, size_t len) -> void {
+	size_t i = 0;
+#if defined(__SSE2__)
+	i = rows_convert16(dots,out,len,false,[](__m128i v) {
+		return _mm_or_si128(_mm_or_si128(bits_get(v,27,0x001F),bits_get(v,13,0x07E0)),
+			_mm_and_si128(v,_mm_set1_epi32(0xF800))
+		);
+	});
+#endif
+	for(; i<len; i++) {
+		const auto& dot = dots[i];
+		short_write(out + i*2,(dot.b>>3) | ((dot.g>>2)<<5) | ((dot.r>>3)<<11),false);
+	}
+}
+auto aya::pack::row_rgb5a1(const aya::CColor* dots, uint8_t* out, size_t len, int test) -> void {
+	size_t i = 0;
+#if defined(__SSE2__)
+	const __m128i alpha_test = _mm_set1_epi32(test);
+	i = rows_convert16(dots,out,len,false,[&](__m128i v) {
+		const __m128i opaque = _mm_cmpgt_epi32(_mm_and_si128(v,_mm_set1_epi32(0xFF)),alpha_test);
+		return _mm_or_si128(
+			_mm_or_si128(bits_get(v,27,0x001F),bits_get(v,14,0x03E0)),
+			_mm_or_si128(bits_get(v,1,0x7C00),_mm_and_si128(opaque,_mm_set1_epi32(0x8000)))
+		);
+	});
+#endif
+	for(; i<len; i++) {
+		const auto& dot = dots[i];
+		const uint32_t short_a = (dot.a <= test) ? 0 : 1;
+		short_write(out + i*2,(dot.b>>3) | ((dot.g>>3)<<5) | ((dot.r>>3)<<10) | (short_a<<15),false);
+	}
+}
+auto aya::pack::row_argb4(const aya::CColor* dots, uint8_t* out, size_t len) -> void {
+	size_t i = 0;
+#if defined(__SSE2__)
+	i = rows_convert16(dots,out,len,false,[](__m128i v) {
+		return _mm_or_si128(
+			_mm_or_si128(bits_get(v,28,0x000F),bits_get(v,16,0x00F0)),
+			_mm_or_si128(bits_get(v,4,0x0F00),_mm_and_si128(_mm_slli_epi32(v,8),_mm_set1_epi32(0xF000)))
+		);
+	});
+#endif
+	for(; i<len; i++) {
+		const auto& dot = dots[i];
+		short_write(out + i*2,(dot.b>>4) | ((dot.g>>4)<<4) | ((dot.r>>4)<<8) | ((dot.a>>4)<<12),false);
+	}
+}
+auto aya::pack::row_argb8(const aya::CColor* dots, uint8_t* out, size_t len) -> void {
+	// b,g,r,a: just every word byteswapped
+	size_t i = 0;
+#if defined(__SSE2__)
+	for(; i+4 <= len; i += 4) {
+		__m128i v = shorts_swap(_mm_loadu_si128(reinterpret_cast<const __m128i*>(dots + i)));
+		v = _mm_shufflelo_epi16(v,_MM_SHUFFLE(2,3,0,1));
+		v = _mm_shufflehi_epi16(v,_MM_SHUFFLE(2,3,0,1));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(out + i*4),v);
+	}
+#endif
+	for(; i<len; i++) {
+		out[i*4 + 0] = dots[i].b;
+		out[i*4 + 1] = dots[i].g;
+		out[i*4 + 2] = dots[i].r;
+		out[i*4 + 3] = dots[i].a;
+	}
+}
+auto aya::pack::row_rgb5a1Sat(const aya::CColor* dots, uint8_t* out, size_t len, bool msb) -> void {
+	// saturn: big-endian, so the byteswap's folded into the store
+	size_t i = 0;
+	const uint32_t msb_bit = msb ? 0x8000 : 0;
+#if defined(__SSE2__)
+	i = rows_convert16(dots,out,len,true,[&](__m128i v) {
+		return _mm_or_si128(
+			_mm_or_si128(bits_get(v,11,0x001F),bits_get(v,14,0x03E0)),
+			_mm_or_si128(bits_get(v,17,0x7C00),_mm_set1_epi32(msb_bit))
+		);
+	});
+#endif
+	for(; i<len; i++) {
+		const auto& dot = dots[i];
+		short_write(out + i*2,(dot.r>>3) | ((dot.g>>3)<<5) | ((dot.b>>3)<<10) | msb_bit,true);
+	}
+}
+auto aya::pack::row_rgb5a1Agb(const aya::CColor* dots, uint8_t* out, size_t len) -> void {
+	// agb: green's 6th bit goes in the msb, same as write_rgb5a1_agb
+	size_t i = 0;
+#if defined(__SSE2__)
+	i = rows_convert16(dots,out,len,false,[](__m128i v) {
+		return _mm_or_si128(
+			_mm_or_si128(bits_get(v,11,0x001F),bits_get(v,14,0x03E0)),
+			_mm_or_si128(bits_get(v,17,0x7C00),bits_get(v,3,0x8000))
+		);
+	});
+#endif
+	for(; i<len; i++) {
+		const auto& dot = dots[i];
+		const uint32_t g_msb = (dot.g>>2) & 1;
+		short_write(out + i*2,(dot.r>>3) | ((dot.g>>3)<<5) | ((dot.b>>3)<<10) | (g_msb<<15),false);
+	}
+}
@@ -5,6 +5,7 @@
 
 #include <cmath>
 #include <map>
+#include <numeric>
 
 constexpr int PGA_TILE_SIZE = 32;
 constexpr int PGA_LINE_SIZE = 16;
@@ -20,6 +21,146 @@ struct PGAWorkingTile {
 	int disp_x,disp_y;
 };
 
+// puts alike <cels> next to each other; <cel_newIndex> gets where each
+// one went. <cel_keyIdx> is each cel's tile index in <keys>.
+static auto cels_reorder(std::vector<std::shared_ptr<aya::CPhoto>>& cels, std::vector<size_t>& cel_newIndex,
+	const aya::CTileKeyList& keys, const std::vector<size_t>& cel_keyIdx
+) -> void {
+	const aya::CCelOrder cel_order(keys,cel_keyIdx);
+	std::vector<std::shared_ptr<aya::CPhoto>> ordered_cels;
+	for(auto cel : cel_order.order()) ordered_cels.push_back(cels[cel]);
+	cels.swap(ordered_cels);
+	for(size_t i=0; i<cel_newIndex.size(); i++) {
+		cel_newIndex[i] = cel_order.index_get(i);
+	}
+}
+
+// how map_write() lays out a map. sizes are in map entries, 0 if unused
+struct CMapLayout {
+	int meta_w,meta_h;   // metatiles
+	int chunk_w,chunk_h; // chunks (of the metatile map, if there's one)
+	int num_flips;
+	bool lift_palet;
+	bool big_endian;
+	bool packed; // aya::mapcodec, in place of plain entries
+	int index_bits; // of each entry's tile (or metatile) index, for packing
+	std::function<scl::blob(scl::blob&)> chunk_compress;
+};
+
+// works out a layout from the -metatile & -mapchunk sizes (in dots).
+// each map entry covers <entry_w>x<entry_h> dots.
+static auto map_getLayout(const char* fn_name, int entry_w, int entry_h,
+	int metatile_x, int metatile_y, int chunk_x, int chunk_y
+) -> CMapLayout {
+	CMapLayout layout = {};
+	if(metatile_x != 0 || metatile_y != 0) {
+		if(metatile_x <= 0 || metatile_y <= 0 || (metatile_x % entry_w) != 0 || (metatile_y % entry_h) != 0) {
+			std::printf("aya::CPhoto::%s(): error: metatile size (%d,%d) must be a multiple of the cel size (%d,%d)\n",
+				fn_name,metatile_x,metatile_y,entry_w,entry_h
+			);
+			std::exit(-1);
+		}
+		layout.meta_w = metatile_x / entry_w;
+		layout.meta_h = metatile_y / entry_h;
+		entry_w = metatile_x;
+		entry_h = metatile_y;
+	}
+	// a chunk size of 0 on one axis means the whole map, for strips
+	if(chunk_x != 0 || chunk_y != 0) {
+		if(chunk_x < 0 || chunk_y < 0 || (chunk_x % entry_w) != 0 || (chunk_y % entry_h) != 0) {
+			std::printf("aya::CPhoto::%s(): error: chunk size (%d,%d) must be a multiple of the (meta)tile size (%d,%d)\n",
+				fn_name,chunk_x,chunk_y,entry_w,entry_h
+			);
+			std::exit(-1);
+		}
+		layout.chunk_w = chunk_x ? (chunk_x / entry_w) : -1;
+		layout.chunk_h = chunk_y ? (chunk_y / entry_h) : -1;
+	}
+	return layout;
+}
+
+// writes <map> (<map_width> entries across) to <blob>. with metatiles,
+// that's a header & the metatile table (see CMetatileTable), and then
+// the map of those. with chunks, the map is cut into chunks, each one
+// compressed on its own, after a directory of where each one starts.
+// packed maps (or chunks) go through aya::mapcodec first.
+static auto map_write(scl::blob& blob, const std::vector<uint16_t>& map, int map_width, const CMapLayout& layout) -> void {
+	auto entry_write = [&](scl::blob& out, uint16_t entry) {
+		if(layout.big_endian) out.write_be_u16(entry);
+		else out.write_u16(entry);
+	};
+
+	// metatiles ----------------------------------------@/
+	std::vector<uint16_t> grid = map;
+	int grid_width = map_width;
+	if(layout.meta_w != 0) {
+		const aya::CMetatileTable metatiles(map,map_width,layout.meta_w,layout.meta_h,layout.num_flips,layout.lift_palet);
+		entry_write(blob,layout.meta_w);
+		entry_write(blob,layout.meta_h);
+		entry_write(blob,metatiles.count());
+		entry_write(blob,0);
+		for(auto entry : metatiles.table()) entry_write(blob,entry);
+		grid = metatiles.map();
+		grid_width = metatiles.map_width();
+	}
+	if(layout.chunk_w == 0) {
+		if(layout.packed) {
+			blob.write_blob(aya::mapcodec::encode(grid,grid_width,layout.big_endian,layout.index_bits));
+			return;
+		}
+		for(auto entry : grid) entry_write(blob,entry);
+		return;
+	}
+
+	// chunks (made on all threads) ---------------------@/
+	const int grid_height = grid_width ? (grid.size() / grid_width) : 0;
+	const int chunk_w = (layout.chunk_w > 0) ? layout.chunk_w : std::max(grid_width,1);
+	const int chunk_h = (layout.chunk_h > 0) ? layout.chunk_h : std::max(grid_height,1);
+	const int num_chunksX = (grid_width + chunk_w - 1) / chunk_w;
+	const int num_chunksY = (grid_height + chunk_h - 1) / chunk_h;
+
+	std::vector<scl::blob> chunks(size_t(num_chunksX) * num_chunksY);
+	aya::util::parallel_for(chunks.size(),[&](size_t begin, size_t end) {
+		for(size_t c=begin; c<end; c++) {
+			const int cx = (c % num_chunksX) * chunk_w;
+			const int cy = (c / num_chunksX) * chunk_h;
+			const int cw = std::min(cx + chunk_w,grid_width) - cx;
+			std::vector<uint16_t> chunk_map;
+			for(int y=cy; y<std::min(cy + chunk_h,grid_height); y++) {
+				for(int x=cx; x<cx + cw; x++) {
+					chunk_map.push_back(grid[(y * grid_width) + x]);
+				}
+			}
+			scl::blob chunk;
+			if(layout.packed) {
+				chunk = aya::mapcodec::encode(chunk_map,cw,layout.big_endian,layout.index_bits);
+			} else {
+				for(auto entry : chunk_map) entry_write(chunk,entry);
+			}
+			chunks[c] = layout.chunk_compress(chunk);
+			chunks[c].pad(4,0); // keep each one word-aligned
+		}
+	});
+
+	// chunks are cut at the map's edges. the directory has one more
+	// offset than there are chunks, so each one's size is known.
+	auto u32_write = [&](uint32_t value) {
+		if(layout.big_endian) blob.write_be_u32(value);
+		else blob.write_u32(value);
+	};
+	entry_write(blob,chunk_w);
+	entry_write(blob,chunk_h);
+	entry_write(blob,num_chunksX);
+	entry_write(blob,num_chunksY);
+	size_t offset = 8 + ((chunks.size() + 1) * 4);
+	for(const auto& chunk : chunks) {
+		u32_write(offset);
+		offset += chunk.size();
+	}
+	u32_write(offset);
+	for(const auto& chunk : chunks) blob.write_blob(chunk);
+}
+
 // KMAP JSON ----------------------------------------------------------------@/
 aya::CKmapJSON::CKmapJSON() {
 	m_layercount = 0;
@@ -290,13 +431,11 @@ aya::CAGBSubframeList::CAGBSubframeList(aya::CPhoto& basephoto,int lenient_count
 	}
 
 	// setup tile grid ----------------------------------@/
-	auto subframe_tiles = basephoto.rect_split(8,8);
-	const int grid_width = basephoto.width()/8;
-	const int grid_height = basephoto.height()/8;
+	const auto occupancy = aya::CTileOccupancy(basephoto,8,8);
+	const int grid_width = occupancy.grid_width();
+	const int grid_height = occupancy.grid_height();
 	const int grid_area = grid_width * grid_height;
-	std::vector<bool> emptygrid;
 	std::vector<bool> usedgrid;
-	emptygrid.resize(grid_area,false);
 	usedgrid.resize(grid_area,false);
 
 	enum AGBShape {
@@ -325,22 +464,9 @@ aya::CAGBSubframeList::CAGBSubframeList(aya::CPhoto& basephoto,int lenient_count
 		        3,  3
 	};
 
-	for(int i=0; i<grid_area; i++) {
-		auto tile = subframe_tiles.at(i);
-		if(tile->all_equals(aya::CColor())) {
-			emptygrid.at(i) = true;
-		}
-	}
-
 	auto usedgrid_get = [&](int x, int y) {
 		return usedgrid.at(x + y * grid_width);
 	};
-	auto emptygrid_get = [&](int x, int y) {
-		return emptygrid.at(x + y * grid_width);
-	};
-	auto tilegrid_get = [&](int x, int y) {
-		return subframe_tiles.at(x + y * grid_width);
-	};
 
 
 	// add subframes ------------------------------------@/
@@ -356,8 +482,11 @@ aya::CAGBSubframeList::CAGBSubframeList(aya::CPhoto& basephoto,int lenient_count
 				if(iy + size.y > grid_height) continue;
 				if(ix + size.x > grid_width) continue;
 
+				// skip if too many tiles in range are empty
+				const int num_empty = area - occupancy.rect_countUsed(ix,iy,size.x,size.y);
+				if(num_empty > lenient_count) continue;
+
 				// break out if anything in range is marked as used
-				int num_empty = 0;
 				bool area_usable = true;
 				for(int y=0; y<size.y; y++) {
 					for(int x=0; x<size.x; x++) {
@@ -365,13 +494,6 @@ aya::CAGBSubframeList::CAGBSubframeList(aya::CPhoto& basephoto,int lenient_count
 							area_usable = false;
 							break;
 						}
-						if(emptygrid_get(x+ix,y+iy)) {
-							num_empty++;
-						}
-						if(num_empty > lenient_count) {
-							area_usable = false;
-							break;
-						}
 					}
 					if(!area_usable) break;
 				}
@@ -388,18 +510,7 @@ aya::CAGBSubframeList::CAGBSubframeList(aya::CPhoto& basephoto,int lenient_count
 		//	const size_t bmp_tileNum = bmp_tileOffset / 32;
 
 			// if all the tiles are empty, leave.
-			int tiles_allEmpty = true;
-			for(int y=0; y<size_y; y++) {
-				for(int x=0; x<size_x; x++) {
-					// mark area as used
-					auto tile = tilegrid_get(x+ix,y+iy);
-					if(!tile->all_equals(aya::CColor())) {
-						tiles_allEmpty = false;
-						break;
-					}
-				}
-			}
-			if(tiles_allEmpty) continue;
+			if(occupancy.rect_isEmpty(ix,iy,size_x,size_y)) continue;
 
 			// write subframe 
 			for(int y=0; y<size_y; y++) {
@@ -689,6 +800,7 @@ auto aya::CPhoto::convert_filePGA(int format, const std::string& json_filename,
 
 		// create tiled image ---------------------------@/
 		std::vector<PGAWorkingTile> tile_table;
+		const auto occupancy = aya::CTileOccupancy(sheetframe,tilesize,tilesize);
 		for(int iy=0; iy<orig_height; iy += tilesize) {
 			for(int ix=0; ix<orig_width; ix += tilesize) {
 				int idx = tile_table.size();
@@ -696,8 +808,8 @@ auto aya::CPhoto::convert_filePGA(int format, const std::string& json_filename,
 				int oy = (idx/PGA_LINE_SIZE) * tilesize;
 
 				// create tile, only if it has pixels
-				auto tile_pic = sheetframe.rect_get(ix,iy,tilesize,tilesize);
-				if(!tile_pic->all_equals(aya::CColor())) {
+				if(!occupancy.tile_isEmpty(ix/tilesize,iy/tilesize)) {
+					auto tile_pic = sheetframe.rect_get(ix,iy,tilesize,tilesize);
 					PGAWorkingTile wrktile = {};
 					wrktile.tile_pic = tile_pic;
 					wrktile.disp_x = ix;
@@ -875,30 +987,66 @@ auto aya::CPhoto::convert_filePGI(int format, bool do_compress) -> scl::blob {
 	return out_blob;
 }
 
-auto aya::CPhoto::convert_fileMGI(int format, bool do_compress) -> scl::blob {
+auto aya::CPhoto::convert_fileMGI(int format, bool do_compress, bool vq_preview) -> scl::blob {
 	bool do_twiddle = marisa_graphfmt::isTwiddled(format);
+	bool do_vq = marisa_graphfmt::isVQ(format);
+	bool do_mipmap = marisa_graphfmt::isMipmapped(format);
 	scl::blob out_blob;
 	
 	int width_po2 = aya::conv_po2(width());
 	int height_po2 = aya::conv_po2(height());
 	int bpp = marisa_graphfmt::getBPP(format);
 
-	CPhoto newpic(width_po2,height_po2);	// new bitmap, po2-sized
+	// strided textures only pad the width out to a multiple of 32, and
+	// only need as many rows as the image has. they have to be 16-bit &
+	// non-twiddled, so use them whenever that's the case & they're smaller.
+	int stride = ((width() + marisa_graphfmt::STRIDE_ALIGN - 1) / marisa_graphfmt::STRIDE_ALIGN) * marisa_graphfmt::STRIDE_ALIGN;
+	bool stride_ok = (bpp == 16) && (!do_twiddle) && (stride <= marisa_graphfmt::STRIDE_MAX);
+	if(stride_ok && ((size_t(stride) * height()) < (size_t(width_po2) * height_po2))) {
+		format |= marisa_graphfmt::strided;
+	}
+	bool do_stride = marisa_graphfmt::isStrided(format);
+	if(do_stride && !stride_ok) {
+		std::printf("aya::CPhoto::convert_fileMGI(): error: strided textures must be non-twiddled, 16-bit & at most %d wide\n",
+			marisa_graphfmt::STRIDE_MAX
+		);
+		std::exit(-1);
+	}
+
+	// new bitmap, po2-sized (or stride-sized)
+	CPhoto newpic(do_stride ? stride : width_po2,do_stride ? height() : height_po2);
 	rect_blit(newpic,0,0,0,0);				// copy entire old photo
 
 	// check if format's correct ------------------------@/
 	if((marisa_graphfmt::getBPP(format) <= 8) && (!do_twiddle)) {
 		std::puts("aya: warning: converting to paletted format with non-twiddled data");
 	}
+	if(do_vq && ((bpp != 16) || (!do_twiddle))) {
+		std::puts("aya::CPhoto::convert_fileMGI(): error: vq textures must be twiddled & 16-bit");
+		std::exit(-1);
+	}
+	if(do_mipmap && ((bpp != 16) || (!do_twiddle) || do_vq)) {
+		std::puts("aya::CPhoto::convert_fileMGI(): error: mipmapped textures must be twiddled, non-vq & 16-bit");
+		std::exit(-1);
+	}
 
 	// generate bitmap ----------------------------------@/
 	size_t bmpsize_orig = 0;
 	scl::blob blob_bmp; {
 		scl::blob temp_bmp;
 
-		if(do_twiddle) {
+		if(do_vq) {
+			auto vq_bmp = newpic.convert_twiddledVQ(format,vq_preview);
+			temp_bmp.write_blob(vq_bmp);
+		} else if(do_mipmap) {
+			auto mipmap_bmp = newpic.convert_twiddledMipmaps(format);
+			temp_bmp.write_blob(mipmap_bmp);
+		} else if(do_twiddle) {
 			auto twiddled_bmp = newpic.convert_twiddled(format);
 			temp_bmp.write_blob(twiddled_bmp);
+		} else if(do_stride) {
+			auto strided_bmp = newpic.convert_raw(format);
+			temp_bmp.write_blob(strided_bmp);
 		} else {
 			auto raw_bmp = convert_raw(format);
 			temp_bmp.write_blob(raw_bmp);
@@ -935,7 +1083,7 @@ auto aya::CPhoto::convert_fileMGI(int format, bool do_compress) -> scl::blob {
 
 	header.width = width();
 	header.height = height();
-	header.width_real = width_po2;
+	header.width_real = do_stride ? stride : width_po2;
 	header.height_real = height_po2;
 	header.format_marisa = format;
 	header.palette_size = blob_palette.size();
@@ -1215,6 +1363,9 @@ auto aya::CPhoto::convert_fileNGI(const aya::CNarumiNGIConvertInfo& info) -> scl
 	return out_blob;
 }
 auto aya::CPhoto::convert_fileNGM(const aya::CNarumiNGMConvertInfo& info) -> scl::blob {
+	return convert_fileNGMShared({this},info).front();
+}
+auto aya::CPhoto::convert_fileNGMShared(const std::vector<aya::CPhoto*>& pics, const aya::CNarumiNGMConvertInfo& info) -> std::vector<scl::blob> {
 	// validate info struct -----------------------------@/
 	const int format = info.format;
 	const bool do_compress = info.do_compress;
@@ -1222,9 +1373,11 @@ auto aya::CPhoto::convert_fileNGM(const aya::CNarumiNGMConvertInfo& info) -> scl
 	int max_numtiles = 1024;
 	if(info.is_12bit) max_numtiles <<= 2;
 
-	if(width()%8 != 0) {
-		std::puts("aya::CPhoto::convert_fileNGM(): error: image X size must be multiple of 8!!");
-		std::exit(-1);
+	for(auto pic : pics) {
+		if(pic->width()%8 != 0) {
+			std::puts("aya::CPhoto::convert_fileNGM(): error: image X size must be multiple of 8!!");
+			std::exit(-1);
+		}
 	}
 
 	// since character numbers are always in sizes of $20,
@@ -1243,58 +1396,84 @@ auto aya::CPhoto::convert_fileNGM(const aya::CNarumiNGMConvertInfo& info) -> scl
 		std::exit(-1);	
 	}
 
-	const int map_width = width() / 8;
-	const int map_height = height() / 8;
-
-	// setup bitmap info --------------------------------@/
-	scl::blob out_blob;
-	scl::blob blob_headersection;
-	scl::blob blob_paletsection;
-	scl::blob blob_mapsection;
-	scl::blob blob_mapsection_real;
+	auto map_layout = map_getLayout("convert_fileNGM",8,8,
+		info.metatile_sizeX,info.metatile_sizeY,info.map_chunkX,info.map_chunkY
+	);
+	map_layout.big_endian = true;
+	map_layout.packed = info.map_packed;
+	map_layout.index_bits = info.is_12bit ? 12 : 10; // 12-bit maps have no flip bits
+	map_layout.chunk_compress = [&](scl::blob& chunk) { return aya::compress(chunk,do_compress); };
+	int header_format = format;
+	header_format |= map_layout.meta_w ? aya::narumi_graphfmt::metatiled : 0;
+	header_format |= map_layout.chunk_w ? aya::narumi_graphfmt::chunked : 0;
+	header_format |= map_layout.packed ? aya::narumi_graphfmt::packed : 0;
+
+	// shared maps --------------------------------------@/
+	// same as with .AGM: one cel table for every map, a map section
+	// for each, and the bitmap section only in the first file.
+	std::vector<int> map_widths;
+	std::vector<size_t> map_firstCel;
+	std::vector<scl::blob> blob_mapsections(pics.size());
 	scl::blob blob_bmpsection;
-	scl::blob blob_bmpsection_real;
-
-	// write section headers ----------------------------@/
-	// bmp & map section's header is written later, though!
-	blob_headersection.write_str("NGM");
-	blob_paletsection.write_str("PAL");
 
 	// write frames -------------------------------------@/
-	auto imagetable = rect_split(8,8); {
-		std::map<uint64_t,size_t> imghash_map;
-		std::map<uint64_t,size_t> imghash_mapRealIdx;
+	std::vector<std::shared_ptr<aya::CPhoto>> imagetable;
+	for(auto pic : pics) {
+		auto cels = pic->rect_split(8,8);
+		map_widths.push_back(pic->width() / 8);
+		map_firstCel.push_back(imagetable.size());
+		imagetable.insert(imagetable.end(),cels.begin(),cels.end());
+	}
+	map_firstCel.push_back(imagetable.size());
+	{
+		const int key_bpp = aya::narumi_graphfmt::getBPP(format);
+		aya::CTileDedupTable imgkey_table(
+			aya::tilekey_size(8,8,key_bpp),
+			imagetable.size()
+		);
+		std::vector<size_t> imgkey_realIdx;
+		std::vector<size_t> map_cels(imagetable.size());
+		std::vector<int> map_flips(imagetable.size());
 		size_t num_processedCel = 0;
 
 		int num_flips = 4;
 		if(info.is_12bit) num_flips = 1;
+		map_layout.num_flips = num_flips;
 
-		for(auto srcpic : imagetable) {
-			const std::array<uint64_t,4> image_hashes = {
-				srcpic->hash_getIndexed(0b00),
-				srcpic->hash_getIndexed(0b01),
-				srcpic->hash_getIndexed(0b10),
-				srcpic->hash_getIndexed(0b11)
-			};
+		// -merge: merge the most alike cels until they fit
+		if(info.merge_cels) {
+			const aya::CTileMerger merger(imagetable,key_bpp,num_flips,max_numtiles / subimage_boundary,pics[0]->m_palette);
+			merger.report_print(pics.size() > 1 ? 0 : map_widths[0],8,8,info.verbose);
+		}
+		// keys for every tile are made on all threads; indices are
+		// then given out in order, so the output's the same as ever.
+		const aya::CTileKeyList tile_keys(imagetable,key_bpp,num_flips);
+		std::vector<std::shared_ptr<aya::CPhoto>> new_cels;
 
+		for(auto srcpic : imagetable) {
 			bool found_used = false;
 			int tile_index = 0;
 			int flip_index = 0;
 
 			for(int fi=0; fi<num_flips; fi++) {
-				const uint64_t hash = image_hashes[fi];
-				if(imghash_map.count(hash) > 0) {
+				const auto cel_id = imgkey_table.find(
+					tile_keys.key_get(num_processedCel,fi),
+					tile_keys.hash_get(num_processedCel,fi)
+				);
+				if(cel_id.has_value()) {
 					flip_index = fi;
-					tile_index = imghash_map[hash];
+					tile_index = cel_id.value();
 					found_used = true;
 					
 					if(info.verbose) {
-						auto get_tileXY = [&](int idx, int &x, int &y) {
-							x = 8 * (idx % (this->width()/8));
-							y = 8 * (idx / (this->width()/8));
+						auto get_tileXY = [&](size_t idx, int &x, int &y) {
+							const size_t map = std::upper_bound(map_firstCel.begin(),map_firstCel.end(),idx) - map_firstCel.begin() - 1;
+							idx -= map_firstCel[map];
+							x = 8 * (idx % map_widths[map]);
+							y = 8 * (idx / map_widths[map]);
 						};
 						
-						int orig_index = imghash_mapRealIdx[hash];
+						int orig_index = imgkey_realIdx.at(cel_id.value());
 						int src_x,src_y;
 						int cel_x,cel_y;
 						get_tileXY(num_processedCel,src_x,src_y);
@@ -1312,100 +1491,157 @@ auto aya::CPhoto::convert_fileNGM(const aya::CNarumiNGMConvertInfo& info) -> scl
 
 			// write tile to bmp/map
 			if(found_used) {
-				blob_mapsection.write_be_u16(tile_index | (flip_index<<10));
+				map_cels[num_processedCel] = tile_index;
+				map_flips[num_processedCel] = flip_index;
 			} else {
 				int index = subimage_count * subimage_boundary;
 
-				if(index > max_numtiles) {
+				if(index >= max_numtiles) {
 					std::printf(
 						"aya::CPhoto::convert_fileNGM(): error: cel count over! (cel count: >=%3d)\n"
-						"consider using the 12-bit flag to use more tiles.\n",
+						"consider using the 12-bit flag to use more tiles.\n"
+						"-merge will merge the most alike cels until they fit.\n",
 						index
 					);
 					std::exit(-1);
 				}
 
-				imghash_map[image_hashes[0]] = index;
-				imghash_mapRealIdx[image_hashes[0]] = num_processedCel;
-				auto bmpblob = srcpic->convert_rawNGI(format);
-				blob_bmpsection.write_blob(bmpblob);
-				blob_mapsection.write_be_u16(index);
-				subimage_datasize = bmpblob.size();
+				imgkey_table.insert(
+					tile_keys.key_get(num_processedCel,0),
+					tile_keys.hash_get(num_processedCel,0),
+					subimage_count
+				);
+				imgkey_realIdx.push_back(num_processedCel);
+				new_cels.push_back(srcpic);
+				map_cels[num_processedCel] = subimage_count;
+				map_flips[num_processedCel] = 0;
 				subimage_count++;
 			}
 
 			num_processedCel++;
 		}
-	}
 
-	// create palette -----------------------------------@/
-	if(aya::narumi_graphfmt::getBPP(format) <= 8) {
-		scl::blob palet_blob;
-		int color_count = 1 << aya::narumi_graphfmt::getBPP(format);
-		for(int p=0; p<color_count; p++) {
-			palet_get(p).write_rgb5a1_sat(palet_blob,false);
+		// order new cels, if asked to ------------------@/
+		std::vector<size_t> cel_newIndex(new_cels.size());
+		std::iota(cel_newIndex.begin(),cel_newIndex.end(),0);
+		if(info.reorder_cels) {
+			cels_reorder(new_cels,cel_newIndex,tile_keys,imgkey_realIdx);
 		}
-		auto palet_blobComp = aya::compress(palet_blob,do_compress);
-		blob_paletsection.write_be_u32(palet_blob.size());
-		blob_paletsection.write_be_u32(palet_blobComp.size());
-		blob_paletsection.write_blob(palet_blobComp);
-	} else {
-		blob_paletsection.write_u32(0);
-	}
 
-	// fix up sections ----------------------------------@/
-	blob_mapsection_real.write_str("CHP"); {
-		blob_mapsection_real.write_be_u16(map_width);
-		blob_mapsection_real.write_be_u16(map_height);
-		scl::blob mapblobComp = aya::compress(blob_mapsection,do_compress);
-		blob_mapsection_real.write_be_u32(blob_mapsection.size());
-		blob_mapsection_real.write_be_u32(mapblobComp.size());
-		blob_mapsection_real.write_blob(mapblobComp);
-	}
+		// write maps -----------------------------------@/
+		for(size_t m=0; m<pics.size(); m++) {
+			std::vector<uint16_t> map;
+			for(size_t i=map_firstCel[m]; i<map_firstCel[m+1]; i++) {
+				map.push_back((cel_newIndex[map_cels[i]] * subimage_boundary) | (map_flips[i]<<10));
+			}
+			map_write(blob_mapsections[m],map,map_widths[m],map_layout);
+		}
 
-	blob_bmpsection_real.write_str("CEL"); {
-		scl::blob bmpblobComp = aya::compress(blob_bmpsection,do_compress);
-		blob_bmpsection_real.write_be_u32(blob_bmpsection.size());
-		blob_bmpsection_real.write_be_u32(bmpblobComp.size());
-		blob_bmpsection_real.write_blob(bmpblobComp);
+		// pack new cels (on all threads) ---------------@/
+		std::vector<scl::blob> cel_blobs(new_cels.size());
+		aya::util::parallel_for(new_cels.size(),[&](size_t begin, size_t end) {
+			for(size_t i=begin; i<end; i++) {
+				cel_blobs[i] = new_cels[i]->convert_rawNGI(format);
+			}
+		});
+		for(const auto& bmpblob : cel_blobs) {
+			blob_bmpsection.write_blob(bmpblob);
+			subimage_datasize = bmpblob.size();
+		}
 	}
 
-	// create header ------------------------------------@/
-	if(info.verbose) {
-		std::printf("\tCEL section: %.2f K\n",
-			((float)blob_bmpsection_real.size()) / 1024.0
-		);
-		std::printf("\tCHP section: %.2f K (n.cels == %d)\n",
-			((float)blob_mapsection_real.size()) / 1024.0,
-			subimage_count
-		);
-	}
-	
-	blob_mapsection_real.pad(pad_size);
-	blob_bmpsection_real.pad(pad_size);
-	blob_paletsection.pad(pad_size);
-	
-	size_t offset_paletsection = pad_size;
-	size_t offset_mapsection = offset_paletsection + blob_paletsection.size();
-	size_t offset_bmpsection = offset_mapsection + blob_mapsection_real.size();
+	std::vector<scl::blob> out_blobs;
+	for(size_t m=0; m<pics.size(); m++) {
+		const auto pic = pics[m];
+		scl::blob out_blob;
+		scl::blob blob_headersection;
+		scl::blob blob_paletsection;
+		scl::blob blob_mapsection_real;
+		scl::blob blob_bmpsection_real;
+		scl::blob& blob_mapsection = blob_mapsections[m];
+
+		// write section headers ------------------------@/
+		// bmp & map section's header is written later, though!
+		blob_headersection.write_str("NGM");
+		blob_paletsection.write_str("PAL");
+
+		// create palette -------------------------------@/
+		if(aya::narumi_graphfmt::getBPP(format) <= 8) {
+			scl::blob palet_blob;
+			int color_count = 1 << aya::narumi_graphfmt::getBPP(format);
+			for(int p=0; p<color_count; p++) {
+				pic->palet_get(p).write_rgb5a1_sat(palet_blob,false);
+			}
+			auto palet_blobComp = aya::compress(palet_blob,do_compress);
+			blob_paletsection.write_be_u32(palet_blob.size());
+			blob_paletsection.write_be_u32(palet_blobComp.size());
+			blob_paletsection.write_blob(palet_blobComp);
+		} else {
+			blob_paletsection.write_u32(0);
+		}
 
-	blob_headersection.write_be_u32(format);
+		// fix up sections ------------------------------@/
+		blob_mapsection_real.write_str("CHP"); {
+			blob_mapsection_real.write_be_u16(map_widths[m]);
+			blob_mapsection_real.write_be_u16(pic->height() / 8);
+			// chunked maps are already compressed (chunk by chunk)
+			const bool map_isCompressed = map_layout.chunk_w != 0;
+			scl::blob mapblobComp = map_isCompressed ? blob_mapsection : aya::compress(blob_mapsection,do_compress);
+			blob_mapsection_real.write_be_u32(blob_mapsection.size());
+			blob_mapsection_real.write_be_u32(mapblobComp.size());
+			blob_mapsection_real.write_blob(mapblobComp);
+		}
 
-	blob_headersection.write_be_u16(width());
-	blob_headersection.write_be_u16(height());
-	blob_headersection.write_be_u16(subimage_count);
-	blob_headersection.write_be_u16(subimage_datasize);
-	blob_headersection.write_be_u32(offset_paletsection);
-	blob_headersection.write_be_u32(offset_mapsection);
-	blob_headersection.write_be_u32(offset_bmpsection);
-	blob_headersection.pad(pad_size);
+		// maps after the first use the first one's cels
+		blob_bmpsection_real.write_str("CEL");
+		if(m == 0) {
+			scl::blob bmpblobComp = aya::compress(blob_bmpsection,do_compress);
+			blob_bmpsection_real.write_be_u32(blob_bmpsection.size());
+			blob_bmpsection_real.write_be_u32(bmpblobComp.size());
+			blob_bmpsection_real.write_blob(bmpblobComp);
+		} else {
+			blob_bmpsection_real.write_be_u32(0);
+			blob_bmpsection_real.write_be_u32(0);
+		}
 
-	out_blob.write_blob(blob_headersection);
-	out_blob.write_blob(blob_paletsection);
-	out_blob.write_blob(blob_mapsection_real);
-	out_blob.write_blob(blob_bmpsection_real);
+		// create header --------------------------------@/
+		if(info.verbose) {
+			std::printf("\tCEL section: %.2f K\n",
+				((float)blob_bmpsection_real.size()) / 1024.0
+			);
+			std::printf("\tCHP section: %.2f K (n.cels == %d)\n",
+				((float)blob_mapsection_real.size()) / 1024.0,
+				subimage_count
+			);
+		}
+		
+		blob_mapsection_real.pad(pad_size);
+		blob_bmpsection_real.pad(pad_size);
+		blob_paletsection.pad(pad_size);
+		
+		size_t offset_paletsection = pad_size;
+		size_t offset_mapsection = offset_paletsection + blob_paletsection.size();
+		size_t offset_bmpsection = offset_mapsection + blob_mapsection_real.size();
 
-	return out_blob;
+		blob_headersection.write_be_u32(header_format);
+
+		blob_headersection.write_be_u16(pic->width());
+		blob_headersection.write_be_u16(pic->height());
+		blob_headersection.write_be_u16(subimage_count);
+		blob_headersection.write_be_u16(subimage_datasize);
+		blob_headersection.write_be_u32(offset_paletsection);
+		blob_headersection.write_be_u32(offset_mapsection);
+		blob_headersection.write_be_u32(offset_bmpsection);
+		blob_headersection.pad(pad_size);
+
+		out_blob.write_blob(blob_headersection);
+		out_blob.write_blob(blob_paletsection);
+		out_blob.write_blob(blob_mapsection_real);
+		out_blob.write_blob(blob_bmpsection_real);
+		out_blobs.push_back(out_blob);
+	}
+
+	return out_blobs;
 }
 
 auto aya::CPhoto::convert_fileAGA(const aya::CAliceAGAConvertInfo& info) -> scl::blob {
@@ -1971,7 +2207,7 @@ auto aya::CPhoto::convert_fileAGI(const aya::CAliceAGIConvertInfo& info) -> scl:
 
 	return out_blob;
 }
-auto aya::CPhoto::convert_fileKMPtoAGM(const aya::CAliceAGMConvertInfo& info) -> scl::blob {
+auto aya::CPhoto::convert_fileKMPtoAGMLayers(const aya::CAliceAGMConvertInfo& info, const std::vector<int>& layer_list) -> std::vector<scl::blob> {
 	/*
 	for converting from a kmap .json + a cel image PNG into an AGM, our goal is
 	to use the .PNG as a reference tilemap.
@@ -1982,7 +2218,8 @@ auto aya::CPhoto::convert_fileKMPtoAGM(const aya::CAliceAGMConvertInfo& info) ->
 	for each of the 4 tiles.
 	
 	to create the final tilemap, we iterate over the kmap tilemap. for each
-	tile, we add the metatiles for that row, flipping if needed.
+	tile, we add the metatiles for that row, flipping if needed. each layer
+	asked for gets its own tilemap (and file), all using the same cels.
 	*/
 
 	// validate info struct -----------------------------@/
@@ -1998,6 +2235,10 @@ auto aya::CPhoto::convert_fileKMPtoAGM(const aya::CAliceAGMConvertInfo& info) ->
 		);
 		std::exit(-1);
 	}
+	if(info.subpalettes) {
+		std::puts("aya::CPhoto::convert_fileKMPtoAGM(): error: sub-palettes don't work with kmaps");
+		std::exit(-1);
+	}
 
 	int cel_sizeX = info.cel_sizeX ? info.cel_sizeX : 8;
 	int cel_sizeY = info.cel_sizeY ? info.cel_sizeY : 8;
@@ -2005,21 +2246,53 @@ auto aya::CPhoto::convert_fileKMPtoAGM(const aya::CAliceAGMConvertInfo& info) ->
 	const int cel_sizeCelX = cel_sizeX / 8;
 	const int cel_sizeCelY = cel_sizeY / 8;
 
+	// the map's always in 8x8 tiles, whatever the cel size
+	auto map_layout = map_getLayout("convert_fileKMPtoAGM",8,8,
+		info.metatile_sizeX,info.metatile_sizeY,info.map_chunkX,info.map_chunkY
+	);
+	map_layout.num_flips = 4;
+	map_layout.lift_palet = true;
+	map_layout.packed = info.map_packed;
+	map_layout.index_bits = 10;
+	map_layout.chunk_compress = [&](scl::blob& chunk) { return info.do_compress ? aya::compress_spd(chunk) : chunk; };
+
 	int rotation = info.kmap_rotate;
 	auto kmapdoc = CKmapJSON(info.kmap_filename);
 	kmapdoc.transform_rotate(rotation);
 
+	std::vector<int> layers = layer_list;
+	if(layers.empty()) {
+		for(int l=0; l<kmapdoc.layer_len(); l++) layers.push_back(l);
+		if(layers.empty()) {
+			std::puts("aya::CPhoto::convert_fileKMPtoAGM(): error: kmap has no layers");
+			std::exit(-1);
+		}
+	}
+	// raw files only hold the cels, which go with the first layer; the
+	// other layers would come out empty
+	if(info.raw_cels && layers.size() > 1) {
+		std::puts("aya::CPhoto::convert_fileKMPtoAGM(): error: raw cels can only be written for one layer");
+		std::exit(-1);
+	}
+	if(!info.ignore_map) {
+		for(auto layer : layers) {
+			if(layer < 0 || layer >= kmapdoc.layer_len()) {
+				std::printf(
+					"aya::CPhoto::convert_fileKMPtoAGM(): error: specified layer (%d) is out of range of map layers.\n",
+					layer
+				);
+				std::exit(-1);
+			}
+		}
+	}
+
 	int subimage_count = 0;
 
-	scl::blob out_blob;
-	scl::blob blob_headersection;
 	scl::blob blob_paletsection;
-	scl::blob blob_mapsection;
 	scl::blob blob_bmpsection;
 
 	std::vector<std::vector<int>> metatilemap;
 
-	const int layer_len = kmapdoc.layer_len();
 	const int map_width = kmapdoc.width();
 	const int map_height = kmapdoc.height();
 	const int map_widthHW = map_width * cel_sizeCelX;
@@ -2029,35 +2302,59 @@ auto aya::CPhoto::convert_fileKMPtoAGM(const aya::CAliceAGMConvertInfo& info) ->
 
 	// write to metatilemap -----------------------------@/
 	auto imagetable = rect_split(cel_sizeX,cel_sizeY); {
-		std::map<uint64_t,size_t> imghash_map;
-		std::map<uint64_t,size_t> imghash_mapRealIdx;
+		const int key_bpp = aya::alice_graphfmt::getBPP(format);
+		aya::CTileDedupTable imgkey_table(
+			aya::tilekey_size(8,8,key_bpp),
+			imagetable.size()
+		);
+		std::vector<size_t> imgkey_realIdx;
 		size_t num_processedCel = 0;
 
 		int num_flips = 4;
 
-		for(auto srcpic_unsplit : imagetable) {
-			auto srcpic_unsplitRot = srcpic_unsplit->img_rotate(rotation);
-			auto srcpic_table = srcpic_unsplitRot->rect_split(8,8);
+		// rotate & split every cel, on every thread
+		std::vector<std::vector<std::shared_ptr<aya::CPhoto>>> cel_tables(imagetable.size());
+		aya::util::parallel_for(imagetable.size(),[&](size_t begin, size_t end) {
+			for(size_t i=begin; i<end; i++) {
+				cel_tables[i] = imagetable[i]->img_rotate(rotation)->rect_split(8,8);
+			}
+		});
+		std::vector<std::shared_ptr<aya::CPhoto>> all_tiles;
+		for(const auto& srcpic_table : cel_tables) {
+			all_tiles.insert(all_tiles.end(),srcpic_table.begin(),srcpic_table.end());
+		}
+		// -merge: merge the most alike cels until they fit
+		if(info.merge_cels) {
+			const aya::CTileMerger merger(all_tiles,key_bpp,num_flips,max_numtiles,m_palette);
+			merger.report_print(0,8,8,info.verbose);
+
+			size_t tile_idx = 0;
+			for(auto& srcpic_table : cel_tables) {
+				for(auto& srcpic : srcpic_table) srcpic = all_tiles[tile_idx++];
+			}
+		}
+		// keys for every tile are made on all threads too; indices are
+		// still given out in order below, so the output's the same as ever.
+		const aya::CTileKeyList tile_keys(all_tiles,key_bpp,num_flips);
+		std::vector<std::shared_ptr<aya::CPhoto>> new_cels;
+
+		for(const auto& srcpic_table : cel_tables) {
 			std::vector<int> metatile;
 
 			// add tiles to metatile --------------------@/
 			for(auto srcpic : srcpic_table) {
-				const std::array<uint64_t,4> image_hashes = {
-					srcpic->hash_getIndexed(0b00),
-					srcpic->hash_getIndexed(0b01),
-					srcpic->hash_getIndexed(0b10),
-					srcpic->hash_getIndexed(0b11)
-				};
-
 				bool found_used = false;
 				int tile_index = 0;
 				int flip_index = 0;
 
 				for(int fi=0; fi<num_flips; fi++) {
-					const uint64_t hash = image_hashes.at(fi);
-					if(imghash_map.count(hash) > 0) {
+					const auto cel_id = imgkey_table.find(
+						tile_keys.key_get(num_processedCel,fi),
+						tile_keys.hash_get(num_processedCel,fi)
+					);
+					if(cel_id.has_value()) {
 						flip_index = fi;
-						tile_index = imghash_map[hash];
+						tile_index = cel_id.value();
 						found_used = true;
 						
 						if(info.verbose) {
@@ -2066,7 +2363,7 @@ auto aya::CPhoto::convert_fileKMPtoAGM(const aya::CAliceAGMConvertInfo& info) ->
 								y = cel_sizeY * (idx / map_width);
 							};
 							
-							int orig_index = imghash_mapRealIdx[hash];
+							int orig_index = imgkey_realIdx.at(cel_id.value());
 							int src_x,src_y;
 							int cel_x,cel_y;
 							get_tileXY(num_processedCel,src_x,src_y);
@@ -2088,25 +2385,27 @@ auto aya::CPhoto::convert_fileKMPtoAGM(const aya::CAliceAGMConvertInfo& info) ->
 				} else {
 					int index = subimage_count;
 
-					if(index > max_numtiles) {
+					if(index >= max_numtiles) {
 						std::printf(
 							"aya::CPhoto::convert_fileKMPtoAGM(): error: cel count over! (cel count: >=%3d)\n"
-							"consider using the 12-bit flag to use more tiles.\n",
+							"consider using the 12-bit flag to use more tiles.\n"
+							"-merge will merge the most alike cels until they fit.\n",
 							index
 						);
 						std::exit(-1);
 					}
 
-					imghash_map[image_hashes[0]] = index;
-					imghash_mapRealIdx[image_hashes[0]] = num_processedCel;
+					imgkey_table.insert(
+						tile_keys.key_get(num_processedCel,0),
+						tile_keys.hash_get(num_processedCel,0),
+						index
+					);
+					imgkey_realIdx.push_back(num_processedCel);
 					/*
 					auto nucel = cel->img_rotate(1);
 					auto bmpblob = nucel->convert_rawAGI(format);
 					*/
-					if(!info.ignore_cel) {
-						auto bmpblob = srcpic->convert_rawAGI(format);
-						blob_bmpsection.write_blob(bmpblob);
-					}
+					new_cels.push_back(srcpic);
 					metatile.push_back(index);
 					subimage_count++;
 				}
@@ -2117,50 +2416,30 @@ auto aya::CPhoto::convert_fileKMPtoAGM(const aya::CAliceAGMConvertInfo& info) ->
 			// add metatile to map ----------------------@/
 			metatilemap.push_back(metatile);
 		}
-	}
 
-	// write to final tilemap ---------------------------@/
-	if(!info.ignore_map) {
-		if(info.kmap_layer < 0 || info.kmap_layer >= layer_len) {
-			std::printf(
-				"aya::CPhoto::convert_fileKMPtoAGM(): error: specified layer (%d) is out of range of map layers.\n",
-				info.kmap_layer
-			);
-			std::exit(-1);
+		// order new cels, if asked to ------------------@/
+		// (done even with -agm_ignorecel, so the map matches the cels
+		// from a run without it)
+		if(info.reorder_cels) {
+			std::vector<size_t> cel_newIndex(new_cels.size());
+			cels_reorder(new_cels,cel_newIndex,tile_keys,imgkey_realIdx);
+			for(auto& metatile : metatilemap) {
+				for(auto& tile : metatile) {
+					tile = cel_newIndex[tile & 0x3FF] | (tile & ~0x3FF);
+				}
+			}
 		}
-		auto& src_layer = kmapdoc.layer_get(info.kmap_layer);
 
-		for(int y=0; y<map_heightHW; y++) {
-			for(int x=0; x<map_widthHW; x++) {
-				const int src_tileX = x/cel_sizeCelX;
-				const int src_tileY = y/cel_sizeCelY;
-				const auto& src_tile = src_layer.at(src_tileX,src_tileY);
-
-				int tile_name = src_tile.m_name;
-				int tile_palet = src_tile.m_palette;
-				int tile_flipH = src_tile.m_flipH;
-				int tile_flipV = src_tile.m_flipV;
-				if(tile_name >= metatilemap.size()) {
-					std::printf(
-						"aya::CPhoto::convert_fileKMPtoAGM(): error: invalid tile name (0x%02X) found at map coord [%3d,%3d]\n"
-						"make sure all tile names are within bounds of the cel image.\n",
-						tile_name,src_tileX,src_tileY
-					);
-					std::exit(-1);
-				}
-				const auto& src_metatile = metatilemap.at(tile_name);
-				
-				int src_x = x%cel_sizeCelX;
-				int src_y = y%cel_sizeCelY;
-				if(tile_flipH) src_x = cel_sizeCelX - src_x - 1;
-				if(tile_flipV) src_y = cel_sizeCelY - src_y - 1;
-				
-				int out_tile = src_metatile.at(src_x + src_y*cel_sizeCelX);
-				out_tile ^= tile_flipH << 10;
-				out_tile ^= tile_flipV << 11;
-				out_tile += tile_palet << 12;
-				blob_mapsection.write_u16(out_tile);
+		// pack new cels (on all threads) ---------------@/
+		if(info.ignore_cel) new_cels.clear();
+		std::vector<scl::blob> cel_blobs(new_cels.size());
+		aya::util::parallel_for(new_cels.size(),[&](size_t begin, size_t end) {
+			for(size_t i=begin; i<end; i++) {
+				cel_blobs[i] = new_cels[i]->convert_rawAGI(format);
 			}
+		});
+		for(const auto& bmpblob : cel_blobs) {
+			blob_bmpsection.write_blob(bmpblob);
 		}
 	}
 
@@ -2189,118 +2468,259 @@ auto aya::CPhoto::convert_fileKMPtoAGM(const aya::CAliceAGMConvertInfo& info) ->
 	constexpr int header_size = 40;
 	constexpr int pad_word = 0xAA;
 	blob_paletsection.pad(32,pad_word); // pad to nearest 16;
-	blob_mapsection.pad(32,pad_word); // pad to nearest 16;
 	blob_bmpsection.pad(32,pad_word); // pad to nearest 16;
 
-	// create header ------------------------------------@/
 	if(info.verbose) {
 		std::printf("\tCEL section: %.2f K\n",
 			((float)blob_bmpsection.size()) / 1024.0
 		);
-		std::printf("\tCHP section: %.2f K (n.cels == %d)\n",
-			((float)blob_mapsection.size()) / 1024.0,
-			subimage_count
-		);
 	}
-	
-	size_t offset_paletsection = header_size;
-	size_t offset_mapsection = offset_paletsection + blob_paletsection.size();
-	size_t offset_bmpsection = offset_mapsection + blob_mapsection.size();
-
-	aya::ALICE_AGMFILE_HEADER header = {};
-	header.magic[0] = 'A';
-	header.magic[1] = 'G';
-	header.magic[2] = 'M';
-	header.format_flags = format;
-	header.width_dot = map_widthDot;
-	header.width_chr = map_widthHW;
-	header.height_dot = map_heightDot;
-	header.height_chr = map_heightHW;
-	header.palet_size = blob_paletsection.size();
-	header.map_size = blob_mapsection.size();
-	header.bitmap_size = blob_bmpsection.size();
-	header.offset_paletsection = offset_paletsection;
-	header.offset_mapsection = offset_mapsection;
-	header.offset_bmpsection = offset_bmpsection;
 
-	header.format_flags |= info.do_compress ? alice_graphfmt::compressed : 0;
-
-	blob_headersection.write_raw(&header,sizeof(header));
-	blob_headersection.pad(header_size,pad_word);
+	// write each layer ---------------------------------@/
+	// like with -share, only the first file gets the cels.
+	std::vector<scl::blob> out_blobs;
+	for(size_t l=0; l<layers.size(); l++) {
+		scl::blob out_blob;
+		scl::blob blob_headersection;
+		scl::blob blob_mapsection;
+		const bool has_cels = (l == 0);
+
+		// write to final tilemap -----------------------@/
+		if(!info.ignore_map) {
+			auto& src_layer = kmapdoc.layer_get(layers[l]);
+
+			std::vector<uint16_t> map;
+			for(int y=0; y<map_heightHW; y++) {
+				for(int x=0; x<map_widthHW; x++) {
+					const int src_tileX = x/cel_sizeCelX;
+					const int src_tileY = y/cel_sizeCelY;
+					const auto& src_tile = src_layer.at(src_tileX,src_tileY);
+
+					int tile_name = src_tile.m_name;
+					int tile_palet = src_tile.m_palette;
+					int tile_flipH = src_tile.m_flipH;
+					int tile_flipV = src_tile.m_flipV;
+					if(tile_name >= metatilemap.size()) {
+						std::printf(
+							"aya::CPhoto::convert_fileKMPtoAGM(): error: invalid tile name (0x%02X) found at map coord [%3d,%3d] (layer %d)\n"
+							"make sure all tile names are within bounds of the cel image.\n",
+							tile_name,src_tileX,src_tileY,layers[l]
+						);
+						std::exit(-1);
+					}
+					const auto& src_metatile = metatilemap.at(tile_name);
+					
+					int src_x = x%cel_sizeCelX;
+					int src_y = y%cel_sizeCelY;
+					if(tile_flipH) src_x = cel_sizeCelX - src_x - 1;
+					if(tile_flipV) src_y = cel_sizeCelY - src_y - 1;
+					
+					int out_tile = src_metatile.at(src_x + src_y*cel_sizeCelX);
+					out_tile ^= tile_flipH << 10;
+					out_tile ^= tile_flipV << 11;
+					out_tile += tile_palet << 12;
+					map.push_back(out_tile);
+				}
+			}
+			map_write(blob_mapsection,map,map_widthHW,map_layout);
+		}
+		blob_mapsection.pad(32,pad_word); // pad to nearest 16;
 
-	if(info.raw_cels) {
-		blob_bmpsection.pad(32 * 256,pad_word);
-		out_blob.write_blob(blob_bmpsection);
-	} else {
-		out_blob.write_blob(blob_headersection);
-		out_blob.write_blob(blob_paletsection);
-		out_blob.write_blob(blob_mapsection);
-		out_blob.write_blob(blob_bmpsection);
+		// create header --------------------------------@/
+		if(info.verbose) {
+			std::printf("\tCHP section: %.2f K (n.cels == %d)\n",
+				((float)blob_mapsection.size()) / 1024.0,
+				subimage_count
+			);
+		}
+		
+		size_t offset_paletsection = header_size;
+		size_t offset_mapsection = offset_paletsection + blob_paletsection.size();
+		size_t offset_bmpsection = offset_mapsection + blob_mapsection.size();
+
+		aya::ALICE_AGMFILE_HEADER header = {};
+		header.magic[0] = 'A';
+		header.magic[1] = 'G';
+		header.magic[2] = 'M';
+		header.format_flags = format;
+		header.width_dot = map_widthDot;
+		header.width_chr = map_widthHW;
+		header.height_dot = map_heightDot;
+		header.height_chr = map_heightHW;
+		header.palet_size = blob_paletsection.size();
+		header.map_size = blob_mapsection.size();
+		header.bitmap_size = has_cels ? blob_bmpsection.size() : 0;
+		header.offset_paletsection = offset_paletsection;
+		header.offset_mapsection = offset_mapsection;
+		header.offset_bmpsection = offset_bmpsection;
+
+		header.format_flags |= info.do_compress ? alice_graphfmt::compressed : 0;
+		header.format_flags |= map_layout.meta_w ? alice_graphfmt::metatiled : 0;
+		header.format_flags |= map_layout.chunk_w ? alice_graphfmt::chunked : 0;
+		header.format_flags |= map_layout.packed ? alice_graphfmt::packed : 0;
+
+		blob_headersection.write_raw(&header,sizeof(header));
+		blob_headersection.pad(header_size,pad_word);
+
+		if(info.raw_cels) {
+			if(has_cels) {
+				blob_bmpsection.pad(32 * 256,pad_word);
+				out_blob.write_blob(blob_bmpsection);
+			}
+		} else {
+			out_blob.write_blob(blob_headersection);
+			out_blob.write_blob(blob_paletsection);
+			out_blob.write_blob(blob_mapsection);
+			if(has_cels) out_blob.write_blob(blob_bmpsection);
+		}
+		out_blobs.push_back(out_blob);
 	}
 
-	return out_blob;
-
+	return out_blobs;
+}
+auto aya::CPhoto::convert_fileKMPtoAGM(const aya::CAliceAGMConvertInfo& info) -> scl::blob {
+	return convert_fileKMPtoAGMLayers(info,{info.kmap_layer}).front();
 }
 auto aya::CPhoto::convert_fileAGM(const aya::CAliceAGMConvertInfo& info) -> scl::blob {
 	if(!info.kmap_filename.empty()) {
 		return convert_fileKMPtoAGM(info);
 	}
+	return convert_fileAGMShared({this},info).front();
+}
+auto aya::CPhoto::convert_fileAGMShared(const std::vector<aya::CPhoto*>& pics, const aya::CAliceAGMConvertInfo& info) -> std::vector<scl::blob> {
 	// validate info struct -----------------------------@/
 	const int format = info.format;
 
-	if((width()%8) != 0 || (height()%8) != 0) {
-		std::puts("aya::CPhoto::convert_fileAGM(): error: image dimensions must be multiple of 8!!");
-		std::exit(-1);
+	for(auto pic : pics) {
+		if((pic->width()%8) != 0 || (pic->height()%8) != 0) {
+			std::puts("aya::CPhoto::convert_fileAGM(): error: image dimensions must be multiple of 8!!");
+			std::exit(-1);
+		}
 	}
 
 	int cel_sizeX = info.cel_sizeX ? info.cel_sizeX : 8;
 	int cel_sizeY = info.cel_sizeY ? info.cel_sizeY : 8;
 	const int max_numtiles = 1024;
-	const int map_width = width() / cel_sizeX;
-	const int map_height = height() / cel_sizeY;
+
+	auto map_layout = map_getLayout("convert_fileAGM",cel_sizeX,cel_sizeY,
+		info.metatile_sizeX,info.metatile_sizeY,info.map_chunkX,info.map_chunkY
+	);
+	map_layout.num_flips = 4;
+	map_layout.lift_palet = true;
+	map_layout.packed = info.map_packed;
+	map_layout.index_bits = 10;
+	map_layout.chunk_compress = [&](scl::blob& chunk) { return info.do_compress ? aya::compress_spd(chunk) : chunk; };
 
 	int subimage_count = 0;
 
-	scl::blob out_blob;
-	scl::blob blob_headersection;
-	scl::blob blob_paletsection;
-	scl::blob blob_mapsection;
+	// sub-palette mode -----------------------------@/
+	// cels keep only the low 4 bits of each pen, so ones that differ only
+	// in their bank dedup to the same cel; the bank goes in the map entry.
+	if(info.subpalettes && (aya::alice_graphfmt::getID(format) != aya::alice_graphfmt::i4)) {
+		std::puts("aya::CPhoto::convert_fileAGM(): error: sub-palettes need the i4 format");
+		std::exit(-1);
+	}
+	int max_bank = 0;
+
+	// shared maps --------------------------------------@/
+	// every map's cels go in one table, so a cel that's in more than
+	// one map is only stored (and counted) once. each map gets its own
+	// map section; only the first file gets the bitmap section.
+	std::vector<int> map_widths;
+	std::vector<size_t> map_firstCel;
+	std::vector<scl::blob> blob_mapsections(pics.size());
 	scl::blob blob_bmpsection;
 
 	// write frames -------------------------------------@/
-	auto imagetable = rect_split(cel_sizeX,cel_sizeY); {
-		std::map<uint64_t,size_t> imghash_map;
-		std::map<uint64_t,size_t> imghash_mapRealIdx;
+	std::vector<std::shared_ptr<aya::CPhoto>> imagetable;
+	for(auto pic : pics) {
+		auto cels = pic->rect_split(cel_sizeX,cel_sizeY);
+		map_widths.push_back(pic->width() / cel_sizeX);
+		map_firstCel.push_back(imagetable.size());
+		imagetable.insert(imagetable.end(),cels.begin(),cels.end());
+	}
+	map_firstCel.push_back(imagetable.size());
+	{
+		const int key_bpp = aya::alice_graphfmt::getBPP(format);
+		aya::CTileDedupTable imgkey_table(
+			aya::tilekey_size(cel_sizeX,cel_sizeY,key_bpp),
+			imagetable.size()
+		);
+		std::vector<size_t> imgkey_realIdx;
+		std::vector<size_t> map_cels(imagetable.size());
+		std::vector<int> map_flips(imagetable.size());
 		size_t num_processedCel = 0;
 
 		int num_flips = 4;
 
-		for(auto srcpic : imagetable) {
-			const std::array<uint64_t,4> image_hashes = {
-				srcpic->hash_getIndexed(0b00),
-				srcpic->hash_getIndexed(0b01),
-				srcpic->hash_getIndexed(0b10),
-				srcpic->hash_getIndexed(0b11)
-			};
+		// finds a cel's map, and its position in that map
+		auto get_tileXY = [&](size_t idx, int &x, int &y) -> size_t {
+			const size_t map = std::upper_bound(map_firstCel.begin(),map_firstCel.end(),idx) - map_firstCel.begin() - 1;
+			idx -= map_firstCel[map];
+			x = cel_sizeX * (idx % map_widths[map]);
+			y = cel_sizeY * (idx / map_widths[map]);
+			return map;
+		};
 
+		// banks come from the original cels, before any get merged
+		std::vector<int> cel_banks(imagetable.size(),0);
+		if(info.subpalettes) {
+			aya::util::parallel_for(imagetable.size(),[&](size_t begin, size_t end) {
+				for(size_t i=begin; i<end; i++) cel_banks[i] = imagetable[i]->palet_getBank(16);
+			});
+			for(size_t i=0; i<imagetable.size(); i++) {
+				if(cel_banks[i] < 0) {
+					int cel_x,cel_y;
+					const size_t map = get_tileXY(i,cel_x,cel_y);
+					if(pics.size() > 1) {
+						std::printf("aya::CPhoto::convert_fileAGM(): error: cel (%3d,%3d) of map %zu uses pens from more than one bank\n",
+							cel_x,cel_y,map
+						);
+					} else {
+						std::printf("aya::CPhoto::convert_fileAGM(): error: cel (%3d,%3d) uses pens from more than one bank\n",
+							cel_x,cel_y
+						);
+					}
+					std::exit(-1);
+				}
+				max_bank = std::max(max_bank,cel_banks[i]);
+			}
+		}
+		// the bank goes in the top 4 bits of each map entry
+		if(info.palet_offset < 0 || (info.palet_offset + max_bank) > 15) {
+			std::printf("aya::CPhoto::convert_fileAGM(): error: palette offset %d + bank %d is past the last palette (15)\n",
+				info.palet_offset,max_bank
+			);
+			std::exit(-1);
+		}
+
+		// -merge: merge the most alike cels until they fit
+		if(info.merge_cels) {
+			const aya::CTileMerger merger(imagetable,key_bpp,num_flips,max_numtiles,pics[0]->m_palette,cel_banks);
+			merger.report_print(pics.size() > 1 ? 0 : map_widths[0],cel_sizeX,cel_sizeY,info.verbose);
+		}
+		// keys for every cel are made on all threads; indices are
+		// then given out in order, so the output's the same as ever.
+		const aya::CTileKeyList tile_keys(imagetable,key_bpp,num_flips);
+		std::vector<std::shared_ptr<aya::CPhoto>> new_cels;
+
+		for(auto srcpic : imagetable) {
 			bool found_used = false;
 			int tile_index = 0;
 			int flip_index = 0;
 
 			for(int fi=0; fi<num_flips; fi++) {
-				const uint64_t hash = image_hashes[fi];
-				if(imghash_map.count(hash) > 0) {
+				const auto cel_id = imgkey_table.find(
+					tile_keys.key_get(num_processedCel,fi),
+					tile_keys.hash_get(num_processedCel,fi)
+				);
+				if(cel_id.has_value()) {
 					flip_index = fi;
-					tile_index = imghash_map[hash];
+					tile_index = cel_id.value();
 					found_used = true;
 					
 					if(info.verbose) {
-						auto get_tileXY = [&](int idx, int &x, int &y) {
-							x = cel_sizeX * (idx % map_width);
-							y = cel_sizeY * (idx / map_width);
-						};
-						
-						int orig_index = imghash_mapRealIdx[hash];
+						int orig_index = imgkey_realIdx.at(cel_id.value());
 						int src_x,src_y;
 						int cel_x,cel_y;
 						get_tileXY(num_processedCel,src_x,src_y);
@@ -2318,35 +2738,70 @@ auto aya::CPhoto::convert_fileAGM(const aya::CAliceAGMConvertInfo& info) -> scl:
 
 			// write tile to bmp/map
 			if(found_used) {
-				blob_mapsection.write_u16((tile_index | (flip_index<<10)) | (info.palet_offset << 12));
+				map_cels[num_processedCel] = tile_index;
+				map_flips[num_processedCel] = flip_index;
 			} else {
 				int index = subimage_count;
 
-				if(index > max_numtiles) {
+				if(index >= max_numtiles) {
 					std::printf(
 						"aya::CPhoto::convert_fileAGM(): error: cel count over! (cel count: >=%3d)\n"
-						"consider using the 12-bit flag to use more tiles.\n",
+						"consider using the 12-bit flag to use more tiles.\n"
+						"-merge will merge the most alike cels until they fit.\n",
 						index
 					);
 					std::exit(-1);
 				}
 
-				imghash_map[image_hashes[0]] = index;
-				imghash_mapRealIdx[image_hashes[0]] = num_processedCel;
-				auto cels = srcpic->rect_split(8,8);
+				imgkey_table.insert(
+					tile_keys.key_get(num_processedCel,0),
+					tile_keys.hash_get(num_processedCel,0),
+					index
+				);
+				imgkey_realIdx.push_back(num_processedCel);
+				new_cels.push_back(srcpic);
+				map_cels[num_processedCel] = index;
+				map_flips[num_processedCel] = 0;
+				subimage_count++;
+			}
+
+			num_processedCel++;
+		}
+
+		// order new cels, if asked to ------------------@/
+		std::vector<size_t> cel_newIndex(new_cels.size());
+		std::iota(cel_newIndex.begin(),cel_newIndex.end(),0);
+		if(info.reorder_cels) {
+			cels_reorder(new_cels,cel_newIndex,tile_keys,imgkey_realIdx);
+		}
+
+		// write maps -----------------------------------@/
+		for(size_t m=0; m<pics.size(); m++) {
+			std::vector<uint16_t> map;
+			for(size_t i=map_firstCel[m]; i<map_firstCel[m+1]; i++) {
+				const int palet_bank = info.palet_offset + cel_banks[i];
+				map.push_back((cel_newIndex[map_cels[i]] | (map_flips[i]<<10)) | (palet_bank << 12));
+			}
+			map_write(blob_mapsections[m],map,map_widths[m],map_layout);
+		}
+
+		// pack new cels (on all threads) ---------------@/
+		std::vector<scl::blob> cel_blobs(new_cels.size());
+		aya::util::parallel_for(new_cels.size(),[&](size_t begin, size_t end) {
+			for(size_t i=begin; i<end; i++) {
+				auto cels = new_cels[i]->rect_split(8,8);
 				for(auto cel : cels) {
 					/*
 					auto nucel = cel->img_rotate(1);
 					auto bmpblob = nucel->convert_rawAGI(format);
 					*/
 					auto bmpblob = cel->convert_rawAGI(format);
-					blob_bmpsection.write_blob(bmpblob);
+					cel_blobs[i].write_blob(bmpblob);
 				}
-				blob_mapsection.write_u16(index | (info.palet_offset << 12));
-				subimage_count++;
 			}
-
-			num_processedCel++;
+		});
+		for(const auto& bmpblob : cel_blobs) {
+			blob_bmpsection.write_blob(bmpblob);
 		}
 	}
 
@@ -2357,71 +2812,92 @@ auto aya::CPhoto::convert_fileAGM(const aya::CAliceAGMConvertInfo& info) -> scl:
 		blob_bmpsection = aya::compress_spd(bmpsection_old);
 	}
 
-	// create palette -----------------------------------@/
-	if(aya::alice_graphfmt::getBPP(format) <= 8) {
-		scl::blob palet_blob;
-		int color_count = 1 << aya::alice_graphfmt::getBPP(format);
-		for(int p=0; p<color_count; p++) {
-			palet_get(p).write_rgb5a1_agb(blob_paletsection);
-		}
-	} else {
-		blob_paletsection.write_u32(0);
-	}
-
-	// pad sections out ---------------------------------@/
 	constexpr int header_size = 40;
 	constexpr int pad_word = 0xAA;
-	blob_paletsection.pad(32,pad_word); // pad to nearest 16;
-	blob_mapsection.pad(32,pad_word); // pad to nearest 16;
 	blob_bmpsection.pad(32,pad_word); // pad to nearest 16;
 
-	// create header ------------------------------------@/
 	if(info.verbose) {
 		std::printf("\tCEL section: %.2f K\n",
 			((float)blob_bmpsection.size()) / 1024.0
 		);
-		std::printf("\tCHP section: %.2f K (n.cels == %d)\n",
-			((float)blob_mapsection.size()) / 1024.0,
-			subimage_count
-		);
 	}
-	
-	size_t offset_paletsection = header_size;
-	size_t offset_mapsection = offset_paletsection + blob_paletsection.size();
-	size_t offset_bmpsection = offset_mapsection + blob_mapsection.size();
 
-	aya::ALICE_AGMFILE_HEADER header = {};
-	header.magic[0] = 'A';
-	header.magic[1] = 'G';
-	header.magic[2] = 'M';
-	header.format_flags = format;
-	header.width_dot = width();
-	header.width_chr = map_width;
-	header.height_dot = height();
-	header.height_chr = map_height;
-	header.palet_size = blob_paletsection.size();
-	header.map_size = blob_mapsection.size();
-	header.bitmap_size = blob_bmpsection.size();
-	header.offset_paletsection = offset_paletsection;
-	header.offset_mapsection = offset_mapsection;
-	header.offset_bmpsection = offset_bmpsection;
-
-	header.format_flags |= info.do_compress ? alice_graphfmt::compressed : 0;
+	std::vector<scl::blob> out_blobs;
+	for(size_t m=0; m<pics.size(); m++) {
+		const auto pic = pics[m];
+		scl::blob out_blob;
+		scl::blob blob_headersection;
+		scl::blob blob_paletsection;
+		scl::blob& blob_mapsection = blob_mapsections[m];
+		const bool has_cels = (m == 0);
+
+		// create palette -------------------------------@/
+		if(aya::alice_graphfmt::getBPP(format) <= 8) {
+			scl::blob palet_blob;
+			int color_count = 1 << aya::alice_graphfmt::getBPP(format);
+			if(info.subpalettes) color_count *= max_bank + 1; // every bank used
+			for(int p=0; p<color_count; p++) {
+				pic->palet_get(p).write_rgb5a1_agb(blob_paletsection);
+			}
+		} else {
+			blob_paletsection.write_u32(0);
+		}
 
-	blob_headersection.write_raw(&header,sizeof(header));
-	blob_headersection.pad(header_size,pad_word);
+		// pad sections out -----------------------------@/
+		blob_paletsection.pad(32,pad_word); // pad to nearest 16;
+		blob_mapsection.pad(32,pad_word); // pad to nearest 16;
 
-	if(info.raw_cels) {
-		blob_bmpsection.pad(32 * 256,pad_word);
-		out_blob.write_blob(blob_bmpsection);
-	} else {
-		out_blob.write_blob(blob_headersection);
-		out_blob.write_blob(blob_paletsection);
-		out_blob.write_blob(blob_mapsection);
-		out_blob.write_blob(blob_bmpsection);
+		// create header --------------------------------@/
+		if(info.verbose) {
+			std::printf("\tCHP section: %.2f K (n.cels == %d)\n",
+				((float)blob_mapsection.size()) / 1024.0,
+				subimage_count
+			);
+		}
+		
+		size_t offset_paletsection = header_size;
+		size_t offset_mapsection = offset_paletsection + blob_paletsection.size();
+		size_t offset_bmpsection = offset_mapsection + blob_mapsection.size();
+
+		aya::ALICE_AGMFILE_HEADER header = {};
+		header.magic[0] = 'A';
+		header.magic[1] = 'G';
+		header.magic[2] = 'M';
+		header.format_flags = format;
+		header.width_dot = pic->width();
+		header.width_chr = map_widths[m];
+		header.height_dot = pic->height();
+		header.height_chr = pic->height() / cel_sizeY;
+		header.palet_size = blob_paletsection.size();
+		header.map_size = blob_mapsection.size();
+		header.bitmap_size = has_cels ? blob_bmpsection.size() : 0;
+		header.offset_paletsection = offset_paletsection;
+		header.offset_mapsection = offset_mapsection;
+		header.offset_bmpsection = offset_bmpsection;
+
+		header.format_flags |= info.do_compress ? alice_graphfmt::compressed : 0;
+		header.format_flags |= map_layout.meta_w ? alice_graphfmt::metatiled : 0;
+		header.format_flags |= map_layout.chunk_w ? alice_graphfmt::chunked : 0;
+		header.format_flags |= map_layout.packed ? alice_graphfmt::packed : 0;
+
+		blob_headersection.write_raw(&header,sizeof(header));
+		blob_headersection.pad(header_size,pad_word);
+
+		if(info.raw_cels) {
+			if(has_cels) {
+				blob_bmpsection.pad(32 * 256,pad_word);
+				out_blob.write_blob(blob_bmpsection);
+			}
+		} else {
+			out_blob.write_blob(blob_headersection);
+			out_blob.write_blob(blob_paletsection);
+			out_blob.write_blob(blob_mapsection);
+			if(has_cels) out_blob.write_blob(blob_bmpsection);
+		}
+		out_blobs.push_back(out_blob);
 	}
 
-	return out_blob;
+	return out_blobs;
 }
 
 auto aya::CPhoto::convert_fileHGI(const aya::CHouraiHGIConvertInfo& info) -> scl::blob {
@@ -2516,61 +2992,115 @@ auto aya::CPhoto::convert_fileHGI(const aya::CHouraiHGIConvertInfo& info) -> scl
 	return out_blob;
 }
 auto aya::CPhoto::convert_fileHGM(const aya::CHouraiHGMConvertInfo& info) -> scl::blob {
+	return convert_fileHGMShared({this},info).front();
+}
+auto aya::CPhoto::convert_fileHGMShared(const std::vector<aya::CPhoto*>& pics, const aya::CHouraiHGMConvertInfo& info) -> std::vector<scl::blob> {
 	// validate info struct -----------------------------@/
 	const int format = info.format;
 
-	if((width()%8) != 0 || (height()%8) != 0) {
-		std::puts("aya::CPhoto::convert_fileHGM(): error: image dimensions must be multiple of 8!!");
-		std::exit(-1);
+	for(auto pic : pics) {
+		if((pic->width()%8) != 0 || (pic->height()%8) != 0) {
+			std::puts("aya::CPhoto::convert_fileHGM(): error: image dimensions must be multiple of 8!!");
+			std::exit(-1);
+		}
 	}
 
-	const int max_numtiles = 256;
-	const int map_width = width() / 8;
-	const int map_height = height() / 8;
+	// gbc mode ---------------------------------------@/
+	// cels past the first 256 go in vram bank 1 (attribute bit 3), and
+	// each cel's cgb palette (attribute bits 0-2) is the 4-color bank its
+	// pens are in. pen 0 of a bank is drawn on the cgb, so unlike with
+	// -agm_subpalettes it counts too. cels only differing in their bank
+	// still dedup to the same cel.
+	const int max_numtiles = info.gbc ? 512 : 256;
+	int max_bank = 0;
 
 	int subimage_count = 0;
 
-	scl::blob out_blob;
-	scl::blob blob_headersection;
-	scl::blob blob_paletsection;
-	scl::blob blob_mapsection;
-	scl::blob blob_attrsection;
+	// shared maps --------------------------------------@/
+	// same as with .AGM: one cel table for every map, map & attribute
+	// sections for each, and the bitmap section only in the first file.
+	std::vector<int> map_widths;
+	std::vector<size_t> map_firstCel;
+	std::vector<scl::blob> blob_mapsections(pics.size());
+	std::vector<scl::blob> blob_attrsections(pics.size());
 	scl::blob blob_bmpsection;
 
 	// write frames -------------------------------------@/
-	auto imagetable = rect_split(8,8); {
-		std::map<uint64_t,size_t> imghash_map;
-		std::map<uint64_t,size_t> imghash_mapRealIdx;
+	std::vector<std::shared_ptr<aya::CPhoto>> imagetable;
+	for(auto pic : pics) {
+		auto cels = pic->rect_split(8,8);
+		map_widths.push_back(pic->width() / 8);
+		map_firstCel.push_back(imagetable.size());
+		imagetable.insert(imagetable.end(),cels.begin(),cels.end());
+	}
+	map_firstCel.push_back(imagetable.size());
+	{
+		const int key_bpp = aya::hourai_graphfmt::getBPP(format);
+		aya::CTileDedupTable imgkey_table(
+			aya::tilekey_size(8,8,key_bpp),
+			imagetable.size()
+		);
+		std::vector<size_t> imgkey_realIdx;
+		std::vector<size_t> map_cels(imagetable.size());
+		std::vector<int> map_flips(imagetable.size());
 		size_t num_processedCel = 0;
 
 		int num_flips = 4;
 
-		for(auto srcpic : imagetable) {
-			const std::array<uint64_t,4> image_hashes = {
-				srcpic->hash_getIndexed(0b00),
-				srcpic->hash_getIndexed(0b01),
-				srcpic->hash_getIndexed(0b10),
-				srcpic->hash_getIndexed(0b11)
-			};
+		// banks come from the original cels, before any get merged
+		std::vector<int> cel_banks(imagetable.size(),0);
+		if(info.gbc) {
+			aya::util::parallel_for(imagetable.size(),[&](size_t begin, size_t end) {
+				for(size_t i=begin; i<end; i++) cel_banks[i] = imagetable[i]->palet_getBank(4,false);
+			});
+			for(size_t i=0; i<imagetable.size(); i++) {
+				if(cel_banks[i] < 0 || cel_banks[i] > 7) {
+					const size_t map = std::upper_bound(map_firstCel.begin(),map_firstCel.end(),i) - map_firstCel.begin() - 1;
+					const size_t idx = i - map_firstCel[map];
+					std::printf("aya::CPhoto::convert_fileHGM(): error: cel (%3d,%3d) %s\n",
+						int(8 * (idx % map_widths[map])),int(8 * (idx / map_widths[map])),
+						(cel_banks[i] < 0) ? "uses pens from more than one bank" : "uses a bank past the 8 cgb palettes"
+					);
+					std::exit(-1);
+				}
+				max_bank = std::max(max_bank,cel_banks[i]);
+			}
+		}
+
+		// -merge: merge the most alike cels until they fit
+		if(info.merge_cels) {
+			const aya::CTileMerger merger(imagetable,key_bpp,num_flips,max_numtiles,pics[0]->m_palette,cel_banks);
+			merger.report_print(pics.size() > 1 ? 0 : map_widths[0],8,8,info.verbose);
+		}
+		// keys for every tile are made on all threads; indices are
+		// then given out in order, so the output's the same as ever.
+		const aya::CTileKeyList tile_keys(imagetable,key_bpp,num_flips);
+		std::vector<std::shared_ptr<aya::CPhoto>> new_cels;
 
+		for(auto srcpic : imagetable) {
 			bool found_used = false;
 			int tile_index = 0;
 			int flip_index = 0;
 
 			for(int fi=0; fi<num_flips; fi++) {
-				const uint64_t hash = image_hashes.at(fi);
-				if(imghash_map.count(hash) > 0) {
+				const auto cel_id = imgkey_table.find(
+					tile_keys.key_get(num_processedCel,fi),
+					tile_keys.hash_get(num_processedCel,fi)
+				);
+				if(cel_id.has_value()) {
 					flip_index = fi;
-					tile_index = imghash_map[hash];
+					tile_index = cel_id.value();
 					found_used = true;
 					
 					if(info.verbose) {
-						auto get_tileXY = [&](int idx, int &x, int &y) {
-							x = 8 * (idx % (this->width()/8));
-							y = 8 * (idx / (this->width()/8));
+						auto get_tileXY = [&](size_t idx, int &x, int &y) {
+							const size_t map = std::upper_bound(map_firstCel.begin(),map_firstCel.end(),idx) - map_firstCel.begin() - 1;
+							idx -= map_firstCel[map];
+							x = 8 * (idx % map_widths[map]);
+							y = 8 * (idx / map_widths[map]);
 						};
 						
-						int orig_index = imghash_mapRealIdx[hash];
+						int orig_index = imgkey_realIdx.at(cel_id.value());
 						int src_x,src_y;
 						int cel_x,cel_y;
 						get_tileXY(num_processedCel,src_x,src_y);
@@ -2588,96 +3118,144 @@ auto aya::CPhoto::convert_fileHGM(const aya::CHouraiHGMConvertInfo& info) -> scl
 
 			// write tile to bmp/map
 			if(found_used) {
-				blob_mapsection.write_u8(tile_index);
-				blob_attrsection.write_u8(flip_index<<5);
+				map_cels[num_processedCel] = tile_index;
+				map_flips[num_processedCel] = flip_index;
 			} else {
 				int index = subimage_count;
 
-				if(index > max_numtiles) {
+				if(index >= max_numtiles) {
 					std::printf(
 						"aya::CPhoto::convert_fileHGM(): error: cel count over! (cel count: >=%3d)\n"
-						"consider using the 12-bit flag to use more tiles.\n",
-						index
+						"%s"
+						"-merge will merge the most alike cels until they fit.\n",
+						index,
+						info.gbc ? "" : "consider using -hgm_gbc to put more tiles in vram bank 1.\n"
 					);
 					std::exit(-1);
 				}
 
-				imghash_map[image_hashes[0]] = index;
-				imghash_mapRealIdx[image_hashes[0]] = num_processedCel;
-				auto bmpblob = srcpic->convert_rawHGI(format);
-				blob_bmpsection.write_blob(bmpblob);
-				blob_mapsection.write_u8(index);
-				blob_attrsection.write_u8(0);
+				imgkey_table.insert(
+					tile_keys.key_get(num_processedCel,0),
+					tile_keys.hash_get(num_processedCel,0),
+					index
+				);
+				imgkey_realIdx.push_back(num_processedCel);
+				new_cels.push_back(srcpic);
+				map_cels[num_processedCel] = index;
+				map_flips[num_processedCel] = 0;
 				subimage_count++;
 			}
 
 			num_processedCel++;
 		}
-	}
 
-	// create palette -----------------------------------@/
-	if(aya::hourai_graphfmt::getBPP(format) <= 8) {
-		scl::blob palet_blob;
-		int color_count = 1 << aya::hourai_graphfmt::getBPP(format);
-		for(int p=0; p<color_count; p++) {
-			palet_get(p).write_rgb5a1_agb(blob_paletsection);
+		// order new cels, if asked to ------------------@/
+		std::vector<size_t> cel_newIndex(new_cels.size());
+		std::iota(cel_newIndex.begin(),cel_newIndex.end(),0);
+		if(info.reorder_cels) {
+			cels_reorder(new_cels,cel_newIndex,tile_keys,imgkey_realIdx);
+		}
+
+		// write maps -----------------------------------@/
+		for(size_t m=0; m<pics.size(); m++) {
+			for(size_t i=map_firstCel[m]; i<map_firstCel[m+1]; i++) {
+				const size_t cel = cel_newIndex[map_cels[i]];
+				int attr = map_flips[i]<<5;
+				if(info.gbc) attr |= ((cel >> 8) << 3) | cel_banks[i];
+				blob_mapsections[m].write_u8(cel & 0xFF);
+				blob_attrsections[m].write_u8(attr);
+			}
+		}
+
+		// pack new cels (on all threads) ---------------@/
+		std::vector<scl::blob> cel_blobs(new_cels.size());
+		aya::util::parallel_for(new_cels.size(),[&](size_t begin, size_t end) {
+			for(size_t i=begin; i<end; i++) {
+				cel_blobs[i] = new_cels[i]->convert_rawHGI(format);
+			}
+		});
+		for(const auto& bmpblob : cel_blobs) {
+			blob_bmpsection.write_blob(bmpblob);
 		}
-	} else {
-		blob_paletsection.write_u32(0);
 	}
 
-	// pad sections out ---------------------------------@/
 	constexpr size_t header_size = 64;
 	constexpr int pad_word = 0xAA;
-	const size_t size_paletsection = blob_paletsection.size();
-	const size_t size_mapsection = blob_mapsection.size();
 	const size_t size_bmpsection = blob_bmpsection.size();
-	blob_paletsection.pad(16,pad_word); // pad to nearest 16;
-	blob_mapsection.pad(16,pad_word); // pad to nearest 16;
-	blob_attrsection.pad(16,pad_word); // pad to nearest 16;
 	blob_bmpsection.pad(16,pad_word); // pad to nearest 16;
 
-	// create header ------------------------------------@/
-	if(info.verbose) {
-		std::printf("\tCEL section: %.2f K\n",
-			((float)blob_bmpsection.size()) / 1024.0
-		);
-		std::printf("\tCHP section: %.2f K (n.cels == %d)\n",
-			((float)blob_mapsection.size()) / 1024.0,
-			subimage_count
-		);
-	}
-	
-	size_t offset_paletsection = header_size;
-	size_t offset_mapsection = offset_paletsection + blob_paletsection.size();
-	size_t offset_attrsection = offset_mapsection + blob_mapsection.size();
-	size_t offset_bmpsection = offset_attrsection + blob_attrsection.size();
-
-	aya::HOURAI_HGMFILE_HEADER header = {};
-	header.magic[0] = 'H';
-	header.magic[1] = 'G';
-	header.magic[2] = 'M';
-	header.width_dot = width();
-	header.width_chr = map_width;
-	header.height_dot = height();
-	header.height_chr = map_height;
-	header.palet_size = size_paletsection;
-	header.map_size = size_mapsection;
-	header.bitmap_size = size_bmpsection;
-	header.offset_paletsection = offset_paletsection;
-	header.offset_mapsection = offset_mapsection;
-	header.offset_attrsection = offset_attrsection;
-	header.offset_bmpsection = offset_bmpsection;
+	std::vector<scl::blob> out_blobs;
+	for(size_t m=0; m<pics.size(); m++) {
+		const auto pic = pics[m];
+		scl::blob out_blob;
+		scl::blob blob_headersection;
+		scl::blob blob_paletsection;
+		scl::blob& blob_mapsection = blob_mapsections[m];
+		scl::blob& blob_attrsection = blob_attrsections[m];
+		const bool has_cels = (m == 0);
+
+		// create palette -------------------------------@/
+		if(aya::hourai_graphfmt::getBPP(format) <= 8) {
+			scl::blob palet_blob;
+			int color_count = 1 << aya::hourai_graphfmt::getBPP(format);
+			if(info.gbc) color_count *= max_bank + 1; // every palette used
+			for(int p=0; p<color_count; p++) {
+				pic->palet_get(p).write_rgb5a1_agb(blob_paletsection);
+			}
+		} else {
+			blob_paletsection.write_u32(0);
+		}
 
-	blob_headersection.write_raw(&header,sizeof(header));
-	blob_headersection.pad(header_size,pad_word);
+		// pad sections out -----------------------------@/
+		const size_t size_paletsection = blob_paletsection.size();
+		const size_t size_mapsection = blob_mapsection.size();
+		blob_paletsection.pad(16,pad_word); // pad to nearest 16;
+		blob_mapsection.pad(16,pad_word); // pad to nearest 16;
+		blob_attrsection.pad(16,pad_word); // pad to nearest 16;
+
+		// create header --------------------------------@/
+		if(info.verbose) {
+			std::printf("\tCEL section: %.2f K\n",
+				((float)(has_cels ? blob_bmpsection.size() : 0)) / 1024.0
+			);
+			std::printf("\tCHP section: %.2f K (n.cels == %d)\n",
+				((float)blob_mapsection.size()) / 1024.0,
+				subimage_count
+			);
+		}
+		
+		size_t offset_paletsection = header_size;
+		size_t offset_mapsection = offset_paletsection + blob_paletsection.size();
+		size_t offset_attrsection = offset_mapsection + blob_mapsection.size();
+		size_t offset_bmpsection = offset_attrsection + blob_attrsection.size();
+
+		aya::HOURAI_HGMFILE_HEADER header = {};
+		header.magic[0] = 'H';
+		header.magic[1] = 'G';
+		header.magic[2] = 'M';
+		header.width_dot = pic->width();
+		header.width_chr = map_widths[m];
+		header.height_dot = pic->height();
+		header.height_chr = pic->height() / 8;
+		header.palet_size = size_paletsection;
+		header.map_size = size_mapsection;
+		header.bitmap_size = has_cels ? size_bmpsection : 0;
+		header.offset_paletsection = offset_paletsection;
+		header.offset_mapsection = offset_mapsection;
+		header.offset_attrsection = offset_attrsection;
+		header.offset_bmpsection = offset_bmpsection;
+
+		blob_headersection.write_raw(&header,sizeof(header));
+		blob_headersection.pad(header_size,pad_word);
 
-	out_blob.write_blob(blob_headersection);
-	out_blob.write_blob(blob_paletsection);
-	out_blob.write_blob(blob_mapsection);
-	out_blob.write_blob(blob_attrsection);
-	out_blob.write_blob(blob_bmpsection);
+		out_blob.write_blob(blob_headersection);
+		out_blob.write_blob(blob_paletsection);
+		out_blob.write_blob(blob_mapsection);
+		out_blob.write_blob(blob_attrsection);
+		if(has_cels) out_blob.write_blob(blob_bmpsection);
+		out_blobs.push_back(out_blob);
+	}
 
-	return out_blob;
+	return out_blobs;
 }
 
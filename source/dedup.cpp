@@ -0,0 +1,136 @@
+#include <aya.h>
+#include <cstring>
+
+namespace aya {
+	CTileDedupTable::CTileDedupTable(size_t key_size, size_t capacity) {
+		if(key_size == 0) {
+			std::puts("aya::CTileDedupTable::CTileDedupTable(): error: key size can't be 0");
+			std::exit(-1);
+		}
+
+		// keep the table at most half-full -------------@/
+		size_t num_slots = 16;
+		while(num_slots < capacity*2) {
+			num_slots <<= 1;
+		}
+
+		m_keySize = key_size;
+		m_slotMask = num_slots - 1;
+		m_slots = std::vector<uint32_t>(num_slots,0);
+		m_hashes.reserve(capacity);
+		m_keys.reserve(capacity * key_size);
+		m_values.reserve(capacity);
+	}
+
+	auto CTileDedupTable::key_hash(const uint8_t* key, size_t key_size) -> uint64_t {
+		// keys are mostly multiples of 8 bytes, so mix a word at a time
+		uint64_t hash = 0x811C9DC5 ^ (key_size * 0x9E3779B97F4A7C15);
+		size_t i = 0;
+		for(; i+8 <= key_size; i += 8) {
+			uint64_t word = 0;
+			std::memcpy(&word,key + i,sizeof(word));
+			hash = (hash ^ word) * 0x100000001B3;
+			hash ^= hash >> 29;
+		}
+		for(; i<key_size; i++) {
+			hash = (hash ^ key[i]) * 0x100000001B3;
+		}
+		hash ^= hash >> 32;
+		return hash;
+	}
+
+	auto CTileDedupTable::key_assert(const std::vector<uint8_t>& key) const -> void {
+		if(key.size() != m_keySize) {
+			std::printf("aya::CTileDedupTable: error: key size mismatch (%zu != %zu)\n",
+				key.size(),m_keySize
+			);
+			std::exit(-1);
+		}
+	}
+
+	auto CTileDedupTable::slot_find(const uint8_t* key, uint64_t hash) const -> size_t {
+		// linear probing; returns either the matching slot or a free one
+		size_t slot = hash & m_slotMask;
+		while(true) {
+			const uint32_t entry = m_slots[slot];
+			if(entry == 0) return slot;
+
+			const size_t idx = entry - 1;
+			if(m_hashes[idx] == hash) {
+				const uint8_t* entry_key = m_keys.data() + idx*m_keySize;
+				if(std::memcmp(entry_key,key,m_keySize) == 0) return slot;
+			}
+			slot = (slot + 1) & m_slotMask;
+		}
+	}
+	auto CTileDedupTable::slot_grow() -> void {
+		const size_t num_slots = m_slots.size() * 2;
+		m_slotMask = num_slots - 1;
+		m_slots = std::vector<uint32_t>(num_slots,0);
+
+		for(size_t idx=0; idx<m_values.size(); idx++) {
+			size_t slot = m_hashes[idx] & m_slotMask;
+			while(m_slots[slot] != 0) {
+				slot = (slot + 1) & m_slotMask;
+			}
+			m_slots[slot] = idx + 1;
+		}
+	}
+
+	auto CTileDedupTable::find(const std::vector<uint8_t>& key) const -> std::optional<size_t> {
+		key_assert(key);
+		return find(key.data(),key_hash(key.data(),m_keySize));
+	}
+	auto CTileDedupTable::insert(const std::vector<uint8_t>& key, size_t value) -> bool {
+		key_assert(key);
+		return insert(key.data(),key_hash(key.data(),m_keySize),value);
+	}
+	auto CTileDedupTable::find(const uint8_t* key, uint64_t hash) const -> std::optional<size_t> {
+		const uint32_t entry = m_slots[slot_find(key,hash)];
+		if(entry == 0) return std::optional<size_t>();
+		return std::optional<size_t>(m_values[entry - 1]);
+	}
+	auto CTileDedupTable::insert(const uint8_t* key, uint64_t hash, size_t value) -> bool {
+		size_t slot = slot_find(key,hash);
+		if(m_slots[slot] != 0) return false; // already in table
+
+		if((size() + 1) * 2 > m_slots.size()) {
+			slot_grow();
+			slot = slot_find(key,hash);
+		}
+
+		m_hashes.push_back(hash);
+		m_keys.insert(m_keys.end(),key,key + m_keySize);
+		m_values.push_back(value);
+		m_slots[slot] = m_values.size();
+		return true;
+	}
+
+	CTileKeyList::CTileKeyList(const std::vector<std::shared_ptr<CPhoto>>& tiles, int bpp, int num_flips) {
+		if(num_flips < 1 || num_flips > 4) {
+			std::printf("aya::CTileKeyList::CTileKeyList(): error: bad flip count (%d)\n",num_flips);
+			std::exit(-1);
+		}
+
+		m_numFlips = num_flips;
+		m_keySize = tiles.empty() ? 0 : aya::tilekey_size(tiles[0]->width(),tiles[0]->height(),bpp);
+		m_keys = std::vector<uint8_t>(tiles.size() * num_flips * m_keySize);
+		m_hashes = std::vector<uint64_t>(tiles.size() * num_flips);
+
+		// every tile's slots are its own, so threads never share writes
+		aya::util::parallel_for(tiles.size(),[&](size_t begin, size_t end) {
+			for(size_t i=begin; i<end; i++) {
+				for(int fi=0; fi<num_flips; fi++) {
+					const auto key = tiles[i]->key_get(fi,bpp);
+					if(key.size() != m_keySize) {
+						std::printf("aya::CTileKeyList::CTileKeyList(): error: tile %zu's size differs\n",i);
+						std::exit(-1);
+					}
+					const size_t slot = (i * num_flips) + fi;
+					std::memcpy(m_keys.data() + (slot * m_keySize),key.data(),m_keySize);
+					m_hashes[slot] = CTileDedupTable::key_hash(key.data(),m_keySize);
+				}
+			}
+		});
+	}
+};
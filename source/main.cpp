@@ -1,6 +1,9 @@
 #include <cstdio>
+#include <charconv>
 #include <memory>
 #include <map>
+#include <optional>
+#include <filesystem>
 
 #include <aya.h>
 #include <argparse.h>
@@ -27,8 +30,20 @@ int main(int argc,const char* argv[]) {
 	std::string param_outfile;
 	std::string param_pixelfmt;
 	std::string param_filetype;
+	std::string param_cachedir;
+	bool param_merge = false;
+	bool param_reorder = false;
+	int param_metatileX = 0;
+	int param_metatileY = 0;
+	int param_mapchunkX = 0;
+	int param_mapchunkY = 0;
+	bool param_mappack = false;
+	std::vector<std::pair<std::string,std::string>> param_shared; // (source,output)
 
 	bool param_mgi_twiddled = false;
+	bool param_mgi_vq = false;
+	bool param_mgi_vqpreview = false;
+	bool param_mgi_mipmap = false;
 
 	std::string param_pga_json;
 	
@@ -57,13 +72,16 @@ int main(int argc,const char* argv[]) {
 	int param_agm_paletoffset = 0;
 	std::string param_agm_kmapjson;
 	int param_agm_kmaplayer = 0;
+	std::optional<std::vector<int>> param_agm_kmaplayers; // empty for all of them
 	int param_agm_kmaprotate = 0;
 	bool param_agm_ignorecel = false;
 	bool param_agm_ignoremap = false;
 	bool param_agm_ignorepalet = false;
+	bool param_agm_subpalettes = false;
 
 	int param_hgi_subimageX = 0;
 	int param_hgi_subimageY = 0;
+	bool param_hgm_gbc = false;
 
 	int pixelfmt_flags = 0xFF;
 
@@ -89,6 +107,29 @@ int main(int argc,const char* argv[]) {
 	if(argparser.arg_isValid("-p")) {
 		do_palette = true;
 	}
+	if(argparser.arg_isValid("-cache",1)) {
+		param_cachedir = argparser.arg_get("-cache",1).at(1);
+	}
+	if(argparser.arg_isValid("-merge")) {
+		param_merge = true;
+	}
+	if(argparser.arg_isValid("-reorder")) {
+		param_reorder = true;
+	}
+	if(argparser.arg_isValid("-metatile",2)) {
+		param_metatileX = std::stoi(argparser.arg_get("-metatile",2).at(1));
+		param_metatileY = std::stoi(argparser.arg_get("-metatile",2).at(2));
+	}
+	if(argparser.arg_isValid("-mapchunk",2)) {
+		param_mapchunkX = std::stoi(argparser.arg_get("-mapchunk",2).at(1));
+		param_mapchunkY = std::stoi(argparser.arg_get("-mapchunk",2).at(2));
+	}
+	if(argparser.arg_isValid("-mappack")) {
+		param_mappack = true;
+	}
+	for(const auto& arg : argparser.arg_getAll("-share",2)) {
+		param_shared.push_back({arg.at(1),arg.at(2)});
+	}
 	if(argparser.arg_isValid("-v")) {
 		do_verbose = true;
 	}
@@ -101,6 +142,16 @@ int main(int argc,const char* argv[]) {
 	if(argparser.arg_isValid("mgi_twiddled")) {
 		param_mgi_twiddled = true;
 	}
+	if(argparser.arg_isValid("-mgi_vq")) {
+		param_mgi_vq = true;
+	}
+	if(argparser.arg_isValid("-mgi_vqpreview")) {
+		param_mgi_vq = true;
+		param_mgi_vqpreview = true;
+	}
+	if(argparser.arg_isValid("-mgi_mipmap")) {
+		param_mgi_mipmap = true;
+	}
 
 	// PGA-specific
 	if(argparser.arg_isValid("-pga_json",1)) {
@@ -167,6 +218,29 @@ int main(int argc,const char* argv[]) {
 	if(argparser.arg_isValid("-agm_kmaplayer",1)) {
 		param_agm_kmaplayer = std::stoi(argparser.arg_get("-agm_kmaplayer",1).at(1));
 	}
+	if(argparser.arg_isValid("-agm_kmaplayers",1)) {
+		const auto list = argparser.arg_get("-agm_kmaplayers",1).at(1);
+		param_agm_kmaplayers.emplace();
+		if(list != "all") {
+			size_t pos = 0;
+			while(pos <= list.size()) {
+				const size_t next = std::min(list.find(',',pos),list.size());
+				// each item must be a whole, non-negative layer number
+				const char* item_start = list.data() + pos;
+				const char* item_end = list.data() + next;
+				int layer = -1;
+				const auto [ptr,ec] = std::from_chars(item_start,item_end,layer);
+				if(item_start == item_end || ec != std::errc() || ptr != item_end || layer < 0) {
+					std::printf("aya: error: bad layer '%s' in -agm_kmaplayers '%s' (should be a list like 0,2,3, or 'all')\n",
+						list.substr(pos,next - pos).c_str(),list.c_str()
+					);
+					std::exit(-1);
+				}
+				param_agm_kmaplayers->push_back(layer);
+				pos = next + 1;
+			}
+		}
+	}
 	if(argparser.arg_isValid("-agm_kmaprotate",1)) {
 		param_agm_kmaprotate = std::stoi(argparser.arg_get("-agm_kmaprotate",1).at(1));
 	}
@@ -179,12 +253,18 @@ int main(int argc,const char* argv[]) {
 	if(argparser.arg_isValid("-agm_ignorepalet")) {
 		param_agm_ignorepalet = true;
 	}
+	if(argparser.arg_isValid("-agm_subpalettes")) {
+		param_agm_subpalettes = true;
+	}
 
 	// HGI-specific
 	if(argparser.arg_isValid("-hgi_subimage",2)) {
 		param_hgi_subimageX = std::stoi(argparser.arg_get("-hgi_subimage",2).at(1));
 		param_hgi_subimageY = std::stoi(argparser.arg_get("-hgi_subimage",2).at(2));
 	}
+	if(argparser.arg_isValid("-hgm_gbc")) {
+		param_hgm_gbc = true;
+	}
 
 	if(do_showusage) {
 		disp_usage();
@@ -208,10 +288,48 @@ int main(int argc,const char* argv[]) {
 	std::printf("pixelfmt: %s\n",param_pixelfmt.c_str());
 	std::printf("nga json: %s\n",param_nga_json.c_str());*/
 
+	auto photo_load = [&](const std::string& filename, bool paletted) -> aya::CPhoto {
+		if(param_cachedir.empty()) return aya::CPhoto(filename,paletted);
+		return aya::CPhoto::file_loadCached(filename,paletted,param_cachedir);
+	};
+
+	// -share: the main source first, then each shared one in order
+	std::vector<aya::CPhoto> shared_pics;
+	auto shared_getPics = [&](aya::CPhoto& pic) -> std::vector<aya::CPhoto*> {
+		for(const auto& shared : param_shared) {
+			shared_pics.push_back(photo_load(shared.first,do_palette));
+		}
+		std::vector<aya::CPhoto*> pics = {&pic};
+		for(auto& shared_pic : shared_pics) pics.push_back(&shared_pic);
+		return pics;
+	};
+	auto shared_send = [&](std::vector<scl::blob>& blobs) {
+		for(size_t i=0; i<blobs.size(); i++) {
+			const auto& filename = (i == 0) ? param_outfile : param_shared.at(i-1).second;
+			if(!blobs[i].file_send(filename)) {
+				std::printf("aya: error: unable to write to file %s\n",filename.c_str());
+				std::exit(-1);
+			}
+		}
+	};
+	if(!param_shared.empty() && (param_filetype != "ngm") && (param_filetype != "agm") && (param_filetype != "hgm")) {
+		std::puts("aya: error: -share only works with .NGM, .AGM and .HGM files");
+		std::exit(-1);
+	}
+	// map layouts are only written by the .NGM & .AGM converters
+	if((param_filetype != "ngm") && (param_filetype != "agm")) {
+		for(const char* arg : {"-metatile","-mapchunk","-mappack"}) {
+			if(argparser.arg_isValid(arg)) {
+				std::printf("aya: error: %s only works with .NGM and .AGM files\n",arg);
+				std::exit(-1);
+			}
+		}
+	}
+
 	// export palette -----------------------------------@/
 	if(!param_exportpal_filename.empty()) {
 		//auto pal_format = param_exportpal_format;
-		auto pic = aya::CPhoto(param_srcfile,do_palette);
+		auto pic = photo_load(param_srcfile,do_palette);
 		scl::blob pal_blob;
 		for(int i=0; i<256; i++) {
 			pal_blob.write_u8(pic.palet_get(i).r);
@@ -265,10 +383,12 @@ int main(int argc,const char* argv[]) {
 		}
 
 		pixelfmt_flags = pixelformat_table_marisa.at(param_pixelfmt);
-		if(!param_mgi_twiddled) pixelfmt_flags |= aya::marisa_graphfmt::nontwiddled;
+		if(param_mgi_vq) pixelfmt_flags |= aya::marisa_graphfmt::vq; // always twiddled
+		if(param_mgi_mipmap) pixelfmt_flags |= aya::marisa_graphfmt::mipmapped; // ^
+		if(!(param_mgi_twiddled || param_mgi_vq || param_mgi_mipmap)) pixelfmt_flags |= aya::marisa_graphfmt::nontwiddled;
 		
-		auto pic = aya::CPhoto(param_srcfile,do_palette);
-		auto pic_blob = pic.convert_fileMGI(pixelfmt_flags, do_compress);
+		auto pic = photo_load(param_srcfile,do_palette);
+		auto pic_blob = pic.convert_fileMGI(pixelfmt_flags, do_compress, param_mgi_vqpreview);
 		if(!pic_blob.file_send(param_outfile)) {
 			std::printf("aya: error: unable to write to file %s\n",param_outfile.c_str());
 			std::exit(-1);
@@ -285,7 +405,7 @@ int main(int argc,const char* argv[]) {
 
 		pixelfmt_flags = pixelformat_table_patchouli.at(param_pixelfmt);
 
-		auto pic = aya::CPhoto(param_srcfile,do_palette);
+		auto pic = photo_load(param_srcfile,do_palette);
 		auto pic_blob = pic.convert_filePGI(pixelfmt_flags, do_compress);
 		if(!pic_blob.file_send(param_outfile)) {
 			std::printf("aya: error: unable to write to file %s\n",param_outfile.c_str());
@@ -303,7 +423,7 @@ int main(int argc,const char* argv[]) {
 
 		pixelfmt_flags = pixelformat_table_patchouli.at(param_pixelfmt);
 
-		auto pic = aya::CPhoto(param_srcfile,do_palette);
+		auto pic = photo_load(param_srcfile,do_palette);
 		auto pic_blob = pic.convert_filePGA(pixelfmt_flags, param_pga_json, do_compress);
 		if(!pic_blob.file_send(param_outfile)) {
 			std::printf("aya: error: unable to write to file %s\n",param_outfile.c_str());
@@ -321,7 +441,7 @@ int main(int argc,const char* argv[]) {
 
 		pixelfmt_flags = pixelformat_table_narumi.at(param_pixelfmt);
 
-		auto pic = aya::CPhoto(param_srcfile,do_palette);
+		auto pic = photo_load(param_srcfile,do_palette);
 		auto info = (aya::CNarumiNGAConvertInfo){
 			.filename_json = param_nga_json,
 			.do_compress = do_compress,
@@ -347,7 +467,7 @@ int main(int argc,const char* argv[]) {
 
 		pixelfmt_flags = pixelformat_table_narumi.at(param_pixelfmt);
 
-		auto pic = aya::CPhoto(param_srcfile,do_palette);
+		auto pic = photo_load(param_srcfile,do_palette);
 		auto info = (aya::CNarumiNGIConvertInfo){
 			.do_compress = do_compress,
 			.format = pixelfmt_flags,
@@ -372,13 +492,25 @@ int main(int argc,const char* argv[]) {
 
 		pixelfmt_flags = pixelformat_table_narumi.at(param_pixelfmt);
 
-		auto pic = aya::CPhoto(param_srcfile,do_palette);
+		auto pic = photo_load(param_srcfile,do_palette);
 		auto info = (aya::CNarumiNGMConvertInfo){
 			.do_compress = do_compress,
 			.format = pixelfmt_flags,
 			.is_12bit = param_ngm_12bit,
-			.verbose = do_verbose
+			.verbose = do_verbose,
+			.merge_cels = param_merge,
+			.reorder_cels = param_reorder,
+			.metatile_sizeX = param_metatileX,
+			.metatile_sizeY = param_metatileY,
+			.map_chunkX = param_mapchunkX,
+			.map_chunkY = param_mapchunkY,
+			.map_packed = param_mappack
 		};
+		if(!param_shared.empty()) {
+			auto blobs = aya::CPhoto::convert_fileNGMShared(shared_getPics(pic),info);
+			shared_send(blobs);
+			return 0;
+		}
 		auto pic_blob = pic.convert_fileNGM(info);
 		if(!pic_blob.file_send(param_outfile)) {
 			std::printf("aya: error: unable to write to file %s\n",param_outfile.c_str());
@@ -396,7 +528,7 @@ int main(int argc,const char* argv[]) {
 
 		pixelfmt_flags = pixelformat_table_alice.at(param_pixelfmt);
 
-		auto pic = aya::CPhoto(param_srcfile,do_palette);
+		auto pic = photo_load(param_srcfile,do_palette);
 		auto info = (aya::CAliceAGAConvertInfo){
 			.filename_json = param_aga_json,
 			.do_compress = do_compress,
@@ -447,7 +579,7 @@ int main(int argc,const char* argv[]) {
 
 		pixelfmt_flags = pixelformat_table.at(param_pixelfmt);
 
-		auto pic = aya::CPhoto(param_srcfile,do_palette);
+		auto pic = photo_load(param_srcfile,do_palette);
 		auto info = (aya::CAliceAGIConvertInfo){
 			.do_compress = do_compress,
 			.format = pixelfmt_flags,
@@ -474,7 +606,7 @@ int main(int argc,const char* argv[]) {
 
 		pixelfmt_flags = pixelformat_table.at(param_pixelfmt);
 
-		auto pic = aya::CPhoto(param_srcfile,do_palette);
+		auto pic = photo_load(param_srcfile,do_palette);
 		auto info = (aya::CAliceAGMConvertInfo){
 			.do_compress = do_compress,
 			.format = pixelfmt_flags,
@@ -489,7 +621,48 @@ int main(int argc,const char* argv[]) {
 			.ignore_cel = param_agm_ignorecel,
 			.ignore_map = param_agm_ignoremap,
 			.ignore_palet = param_agm_ignorepalet,
+			.merge_cels = param_merge,
+			.reorder_cels = param_reorder,
+			.subpalettes = param_agm_subpalettes,
+			.metatile_sizeX = param_metatileX,
+			.metatile_sizeY = param_metatileY,
+			.map_chunkX = param_mapchunkX,
+			.map_chunkY = param_mapchunkY,
+			.map_packed = param_mappack
 		};
+		if(!param_shared.empty()) {
+			if(!param_agm_kmapjson.empty()) {
+				std::puts("aya: error: -share doesn't work with kmaps");
+				std::exit(-1);
+			}
+			auto blobs = aya::CPhoto::convert_fileAGMShared(shared_getPics(pic),info);
+			shared_send(blobs);
+			return 0;
+		}
+		if(param_agm_kmaplayers.has_value()) {
+			if(param_agm_kmapjson.empty()) {
+				std::puts("aya: error: -agm_kmaplayers needs a kmap (-agm_kmapjson)");
+				std::exit(-1);
+			}
+			// the first layer goes to <output_file>, the rest next to it
+			const auto& layers = param_agm_kmaplayers.value();
+			auto blobs = pic.convert_fileKMPtoAGMLayers(info,layers);
+			const std::filesystem::path out_path(param_outfile);
+			for(size_t i=0; i<blobs.size(); i++) {
+				auto filename = param_outfile;
+				if(i != 0) {
+					const int layer = layers.empty() ? i : layers[i];
+					auto layer_path = out_path;
+					layer_path.replace_filename(out_path.stem().string() + "_" + std::to_string(layer) + out_path.extension().string());
+					filename = layer_path.string();
+				}
+				if(!blobs[i].file_send(filename)) {
+					std::printf("aya: error: unable to write to file %s\n",filename.c_str());
+					std::exit(-1);
+				}
+			}
+			return 0;
+		}
 		auto pic_blob = pic.convert_fileAGM(info);
 		if(!pic_blob.file_send(param_outfile)) {
 			std::printf("aya: error: unable to write to file %s\n",param_outfile.c_str());
@@ -508,7 +681,7 @@ int main(int argc,const char* argv[]) {
 
 		pixelfmt_flags = pixelformat_table.at(param_pixelfmt);
 
-		auto pic = aya::CPhoto(param_srcfile,do_palette);
+		auto pic = photo_load(param_srcfile,do_palette);
 		auto info = (aya::CHouraiHGIConvertInfo){
 			.do_compress = do_compress,
 			.format = pixelfmt_flags,
@@ -534,12 +707,20 @@ int main(int argc,const char* argv[]) {
 
 		pixelfmt_flags = pixelformat_table.at(param_pixelfmt);
 
-		auto pic = aya::CPhoto(param_srcfile,do_palette);
+		auto pic = photo_load(param_srcfile,do_palette);
 		auto info = (aya::CHouraiHGMConvertInfo){
 			.do_compress = do_compress,
 			.format = pixelfmt_flags,
-			.verbose = do_verbose
+			.verbose = do_verbose,
+			.merge_cels = param_merge,
+			.reorder_cels = param_reorder,
+			.gbc = param_hgm_gbc
 		};
+		if(!param_shared.empty()) {
+			auto blobs = aya::CPhoto::convert_fileHGMShared(shared_getPics(pic),info);
+			shared_send(blobs);
+			return 0;
+		}
 		auto pic_blob = pic.convert_fileHGM(info);
 		if(!pic_blob.file_send(param_outfile)) {
 			std::printf("aya: error: unable to write to file %s\n",param_outfile.c_str());
@@ -565,9 +746,26 @@ static void disp_usage() {
 		"\t-nc               don't use gz compression\n"
 		"\t-p                use palette\n"
 		"\t-v                verbose flag\n"
+		"\t-cache <dir>      cache decoded source images in <dir> for later runs\n"
+		"\t-merge            (.NGM/.AGM/.HGM) if a map has too many unique cels,\n"
+		"\t                  merge the most alike ones until it fits (lossy)\n"
+		"\t-reorder          (.NGM/.AGM/.HGM) put alike cels next to each other,\n"
+		"\t                  so the bitmap section compresses better\n"
+		"\t-metatile <x> <y> (.NGM/.AGM) store the map as a table of its <x,y>px\n"
+		"\t                  metatiles, plus a map of those\n"
+		"\t-mapchunk <x> <y> (.NGM/.AGM) cut the map into <x,y>px chunks, each one\n"
+		"\t                  compressed on its own (0 = the whole width/height)\n"
+		"\t-mappack          (.NGM/.AGM) pack the map (or each chunk) by splitting\n"
+		"\t                  its entries into delta & run-length coded streams\n"
+		"\t-share <src> <out> (.NGM/.AGM/.HGM) also convert map <src> to <out>, sharing\n"
+		"\t                  cels with the main map. can be given more than once;\n"
+		"\t                  the cels for all maps are only written to <output_file>\n"
 		"\t.MGI specifics:\n"
 		"\t\tformats: i4,i8,rgb565,rgb5a1,argb4444\n"
 		"\t\t-mgi_twiddled           twiddle texture\n"
+		"\t\t-mgi_vq                 vq-compress texture (16-bit formats only, always twiddled)\n"
+		"\t\t-mgi_vqpreview          like -mgi_vq, but with a quick, rougher codebook\n"
+		"\t\t-mgi_mipmap             add mipmaps (square 16-bit textures only, always twiddled)\n"
 		"\t.PGI specifics:\n"
 		"\t\tformats: i4,i8,rgb565,rgb5a1,argb4,argb8\n"
 		"\t.PGA specifics:\n"
@@ -600,11 +798,16 @@ static void disp_usage() {
 		"\t\tformats: i4,i8,rgb\n"
 		"\t\t-agm_celsize <x> <y>    treats each cel as <X,Y>px cels before later dividing to 8x8\n"
 		"\t\t-agm_paletoffset <p>    adds <p> to each tile's palette index\n"
+		"\t\t-agm_subpalettes        (i4) takes each cel's palette index from its pens' bank (pen/16)\n"
 		"\t\t-agm_kmapjson <json>    specifies kmap .json to use\n"
 		"\t\t-agm_kmaplayer <l>      specifies layer of the kmap .json to use\n"
+		"\t\t-agm_kmaplayers <l,..>  converts several layers (or 'all') in one go, sharing cels.\n"
+		"\t\t                        the first goes to <output_file>, the rest to <output>_<l>.agm\n"
 		"\t\t-agm_kmaprotate <r>     specifies <r>otation of map&cels (in 90deg increments, 0=0,1=90)\n"
 		"\t.HGM specifics:\n"
 		"\t\tformats: i2\n"
+		"\t\t-hgm_gbc                (gbc) allows 512 cels, putting the last 256 in vram bank 1,\n"
+		"\t\t                        and takes each cel's palette from its pens' bank (pen/4)\n"
 		"\t.HGI specifics:\n"
 		"\t\tformats: i2\n"
 		"\t\t-hgi_subimage <x> <y>   divides image into subimages, each with size (x,y)\n"
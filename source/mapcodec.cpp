@@ -0,0 +1,233 @@
+#include <aya.h>
+
+/*
+ * plane-split map codec. each map entry is cut into its tile index
+ * (the low <index_bits> bits; 10 for most maps, 12 for ngm 12-bit ones),
+ * the 2 flip bits above that, and the palette in what's left. each of
+ * those goes in its own stream. indices are stored as the difference from the
+ * one before them (along a row, or down a column; whichever packs
+ * smaller), since new tiles are numbered in the order they show up.
+ * every stream is then run-length coded, with all numbers as varints:
+ *
+ *	run header: varint ((length-1)<<1 | is_repeat)
+ *	- repeat run: one value, used <length> times
+ *	- literal run: <length> values
+ *
+ * varints are 7 bits a byte, low bits first, with bit 7 set on every
+ * byte but the last. index differences are zigzagged first (0,-1,1,-2..
+ * -> 0,1,2,3..), so small ones of either sign stay 1 byte.
+*/
+
+namespace {
+	constexpr int PLANE_INDEX = 0;
+	constexpr int PLANE_FLIP = 1;
+	constexpr int PLANE_PALET = 2;
+	constexpr int NUM_PLANES = 3;
+	constexpr int HEADER_SIZE = 8 + (4 * NUM_PLANES);
+	constexpr int MIN_REPEAT = 3; // shorter repeats are cheaper as literals
+	constexpr uint16_t FLAG_COLUMNS = 1;
+	constexpr int FLIP_BITS = 2;
+
+	// how the bits of a map entry are split up
+	struct CEntryLayout {
+		int index_bits;
+		auto index_mask() const -> uint32_t { return (1u << index_bits) - 1; }
+		auto index_get(uint16_t entry) const -> uint32_t { return entry & index_mask(); }
+		auto flip_get(uint16_t entry) const -> uint32_t { return (entry >> index_bits) & ((1 << FLIP_BITS) - 1); }
+		auto palet_get(uint16_t entry) const -> uint32_t { return entry >> (index_bits + FLIP_BITS); }
+		auto entry_make(uint32_t index, uint32_t flip, uint32_t palet) const -> uint16_t {
+			return (index & index_mask())
+				| ((flip & ((1 << FLIP_BITS) - 1)) << index_bits)
+				| (palet << (index_bits + FLIP_BITS));
+		}
+	};
+
+	auto zigzag_encode(int32_t value) -> uint32_t {
+		return (uint32_t(value) << 1) ^ uint32_t(value >> 31);
+	}
+	auto zigzag_decode(uint32_t value) -> int32_t {
+		return int32_t(value >> 1) ^ -int32_t(value & 1);
+	}
+
+	auto varint_write(std::vector<uint8_t>& out, uint32_t value) -> void {
+		while(value >= 0x80) {
+			out.push_back(0x80 | (value & 0x7F));
+			value >>= 7;
+		}
+		out.push_back(value);
+	}
+	auto varint_read(const uint8_t*& data, const uint8_t* data_end) -> uint32_t {
+		uint32_t value = 0;
+		for(int shift=0; shift<32; shift += 7) {
+			if(data >= data_end) {
+				std::puts("aya::mapcodec::decode(): error: stream ends mid-number");
+				std::exit(-1);
+			}
+			const uint8_t byte = *data++;
+			value |= uint32_t(byte & 0x7F) << shift;
+			if(!(byte & 0x80)) break;
+		}
+		return value;
+	}
+
+	auto plane_encode(const std::vector<uint32_t>& values) -> std::vector<uint8_t> {
+		std::vector<uint8_t> out;
+		auto repeat_len = [&](size_t i) -> size_t {
+			size_t len = 1;
+			while(i+len < values.size() && values[i+len] == values[i]) len++;
+			return len;
+		};
+		size_t i = 0;
+		while(i < values.size()) {
+			const size_t len = repeat_len(i);
+			if(len >= MIN_REPEAT) {
+				varint_write(out,((len-1) << 1) | 1);
+				varint_write(out,values[i]);
+				i += len;
+				continue;
+			}
+			// literals, up to the next run worth repeating
+			size_t end = i + len;
+			while(end < values.size() && repeat_len(end) < MIN_REPEAT) end += repeat_len(end);
+			varint_write(out,(end-i-1) << 1);
+			for(; i<end; i++) varint_write(out,values[i]);
+		}
+		return out;
+	}
+	auto plane_decode(const uint8_t* data, size_t size, size_t count) -> std::vector<uint32_t> {
+		std::vector<uint32_t> values;
+		values.reserve(count);
+		const uint8_t *data_end = data + size;
+		while(values.size() < count) {
+			const uint32_t header = varint_read(data,data_end);
+			const size_t len = (header >> 1) + 1;
+			if(values.size() + len > count) {
+				std::puts("aya::mapcodec::decode(): error: run goes past the end of the map");
+				std::exit(-1);
+			}
+			if(header & 1) {
+				values.insert(values.end(),len,varint_read(data,data_end));
+			} else {
+				for(size_t i=0; i<len; i++) values.push_back(varint_read(data,data_end));
+			}
+		}
+		return values;
+	}
+
+	// map position of the <i>th entry, in row or column order
+	auto order_getPos(size_t i, int map_width, int map_height, bool columns) -> size_t {
+		if(!columns) return i;
+		return ((i % map_height) * map_width) + (i / map_height);
+	}
+
+	auto planes_encode(const std::vector<uint16_t>& map, int map_width, bool columns, const CEntryLayout& layout) -> std::array<std::vector<uint8_t>,NUM_PLANES> {
+		const int map_height = map.size() / map_width;
+		const int line_len = columns ? map_height : map_width;
+		std::array<std::vector<uint32_t>,NUM_PLANES> planes;
+		for(size_t i=0; i<map.size(); i++) {
+			const uint16_t entry = map[order_getPos(i,map_width,map_height,columns)];
+			// each line starts off from where the last one did
+			size_t pred_i = i - 1;
+			if((i % line_len) == 0) pred_i = i - line_len;
+			const int pred = (i == 0) ? 0 : layout.index_get(map[order_getPos(pred_i,map_width,map_height,columns)]);
+			planes[PLANE_INDEX].push_back(zigzag_encode(int(layout.index_get(entry)) - pred));
+			planes[PLANE_FLIP].push_back(layout.flip_get(entry));
+			planes[PLANE_PALET].push_back(layout.palet_get(entry));
+		}
+		std::array<std::vector<uint8_t>,NUM_PLANES> streams;
+		for(int p=0; p<NUM_PLANES; p++) streams[p] = plane_encode(planes[p]);
+		return streams;
+	}
+};
+
+auto aya::mapcodec::decode(const uint8_t* data, size_t size, bool big_endian) -> std::vector<uint16_t> {
+	auto u16_read = [&](size_t offset) -> uint32_t {
+		return big_endian ? ((data[offset] << 8) | data[offset+1]) : (data[offset] | (data[offset+1] << 8));
+	};
+	auto u32_read = [&](size_t offset) -> uint32_t {
+		return big_endian ? ((u16_read(offset) << 16) | u16_read(offset+2)) : (u16_read(offset) | (u16_read(offset+2) << 16));
+	};
+	if(size < HEADER_SIZE) {
+		std::puts("aya::mapcodec::decode(): error: stream's too small for its header");
+		std::exit(-1);
+	}
+
+	// read header --------------------------------------@/
+	const int map_width = u16_read(0);
+	const int map_height = u16_read(2);
+	const bool columns = u16_read(4) & FLAG_COLUMNS;
+	const CEntryLayout layout = { .index_bits = int(u16_read(6)) };
+	const size_t count = size_t(map_width) * map_height;
+	if(layout.index_bits < 1 || layout.index_bits > (16 - FLIP_BITS)) {
+		std::printf("aya::mapcodec::decode(): error: bad index bit count (%d)\n",layout.index_bits);
+		std::exit(-1);
+	}
+
+	std::array<std::vector<uint32_t>,NUM_PLANES> planes;
+	size_t offset = HEADER_SIZE;
+	for(int p=0; p<NUM_PLANES; p++) {
+		const size_t plane_size = u32_read(8 + (4*p));
+		if(offset + plane_size > size) {
+			std::puts("aya::mapcodec::decode(): error: plane goes past the end of the stream");
+			std::exit(-1);
+		}
+		planes[p] = plane_decode(data + offset,plane_size,count);
+		offset += plane_size;
+	}
+
+	// undo deltas & put entries back together ----------@/
+	const int line_len = columns ? map_height : map_width;
+	std::vector<uint16_t> map(count);
+	for(size_t i=0; i<count; i++) {
+		size_t pred_i = i - 1;
+		if((i % line_len) == 0) pred_i = i - line_len;
+		const int pred = (i == 0) ? 0 : layout.index_get(map[order_getPos(pred_i,map_width,map_height,columns)]);
+		const int index = pred + zigzag_decode(planes[PLANE_INDEX][i]);
+		map[order_getPos(i,map_width,map_height,columns)] = layout.entry_make(index,planes[PLANE_FLIP][i],planes[PLANE_PALET][i]);
+	}
+	return map;
+}
+
+auto aya::mapcodec::encode(const std::vector<uint16_t>& map, int map_width, bool big_endian, int index_bits) -> scl::blob {
+	scl::blob out;
+	if(map_width <= 0 || map.empty() || (map.size() % map_width) != 0) {
+		std::printf("aya::mapcodec::encode(): error: map size (%zu) isn't a multiple of its width (%d)\n",
+			map.size(),map_width
+		);
+		std::exit(-1);
+	}
+	if(index_bits < 1 || index_bits > (16 - FLIP_BITS)) {
+		std::printf("aya::mapcodec::encode(): error: bad index bit count (%d)\n",index_bits);
+		std::exit(-1);
+	}
+	const CEntryLayout layout = { .index_bits = index_bits };
+	const int map_height = map.size() / map_width;
+
+	// try both orders, keep the smaller ----------------@/
+	auto streams_size = [](const std::array<std::vector<uint8_t>,NUM_PLANES>& streams) {
+		size_t size = 0;
+		for(const auto& stream : streams) size += stream.size();
+		return size;
+	};
+	const auto streams_rows = planes_encode(map,map_width,false,layout);
+	const auto streams_cols = planes_encode(map,map_width,true,layout);
+	const bool columns = streams_size(streams_cols) < streams_size(streams_rows);
+	const auto& streams = columns ? streams_cols : streams_rows;
+
+	// write ----------------------------------------------@/
+	auto u16_write = [&](uint16_t value) {
+		if(big_endian) out.write_be_u16(value);
+		else out.write_u16(value);
+	};
+	auto u32_write = [&](uint32_t value) {
+		if(big_endian) out.write_be_u32(value);
+		else out.write_u32(value);
+	};
+	u16_write(map_width);
+	u16_write(map_height);
+	u16_write(columns ? FLAG_COLUMNS : 0);
+	u16_write(index_bits);
+	for(const auto& stream : streams) u32_write(stream.size());
+	for(const auto& stream : streams) out.write_raw(stream.data(),stream.size());
+	return out;
+}
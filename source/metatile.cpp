@@ -0,0 +1,75 @@
+#include <aya.h>
+#include <cstring>
+
+aya::CMetatileTable::CMetatileTable(const std::vector<uint16_t>& map, int map_width, int width, int height,
+	int num_flips, bool lift_palet
+) : m_width(width),m_height(height),m_mapWidth(0),m_mapHeight(0),m_table(),m_map()
+{
+	// validate -----------------------------------------@/
+	const int map_height = map_width ? (map.size() / map_width) : 0;
+	if(width <= 0 || height <= 0 || (map_width % width) != 0 || (map_height % height) != 0) {
+		std::printf("aya::CMetatileTable::CMetatileTable(): error: map (%d,%d) doesn't divide into %dx%d metatiles\n",
+			map_width,map_height,width,height
+		);
+		std::exit(-1);
+	}
+	m_mapWidth = map_width / width;
+	m_mapHeight = map_height / height;
+
+	const size_t block_len = size_t(width) * height;
+	const size_t max_count = (num_flips > 1 || lift_palet) ? 1024 : 4096;
+	const uint16_t palet_mask = lift_palet ? 0xF000 : 0;
+	aya::CTileDedupTable block_table(block_len * sizeof(uint16_t),size_t(m_mapWidth) * m_mapHeight);
+
+	std::vector<uint16_t> block(block_len);
+	std::vector<uint16_t> block_flipped(block_len);
+	for(int my=0; my<m_mapHeight; my++) {
+		for(int mx=0; mx<m_mapWidth; mx++) {
+			// get block, lifting its palette out if it's the same throughout
+			for(int y=0; y<height; y++) {
+				for(int x=0; x<width; x++) {
+					block[(y * width) + x] = map[(((my * height) + y) * map_width) + (mx * width) + x];
+				}
+			}
+			uint16_t palet = block[0] & palet_mask;
+			for(auto entry : block) {
+				if((entry & palet_mask) != palet) palet = 0;
+			}
+			for(auto& entry : block) entry &= ~palet;
+
+			// look up every flip, as tiles are -------------@/
+			// a flipped block is mirrored, with each entry flipped too.
+			std::optional<size_t> found;
+			int flip_index = 0;
+			for(int fi=0; fi<num_flips && !found.has_value(); fi++) {
+				const bool flip_x = fi & 1;
+				const bool flip_y = (fi >> 1) & 1;
+				for(int y=0; y<height; y++) {
+					const int fy = flip_y ? (height-y-1) : y;
+					for(int x=0; x<width; x++) {
+						const int fx = flip_x ? (width-x-1) : x;
+						block_flipped[(y * width) + x] = block[(fy * width) + fx] ^ (fi << 10);
+					}
+				}
+				const auto key = reinterpret_cast<const uint8_t*>(block_flipped.data());
+				found = block_table.find(key,aya::CTileDedupTable::key_hash(key,block_table.key_size()));
+				flip_index = fi;
+			}
+
+			if(!found.has_value()) {
+				if(count() >= max_count) {
+					std::printf("aya::CMetatileTable::CMetatileTable(): error: metatile count over! (count: >=%4zu)\n",
+						max_count
+					);
+					std::exit(-1);
+				}
+				const auto key = reinterpret_cast<const uint8_t*>(block.data());
+				block_table.insert(key,aya::CTileDedupTable::key_hash(key,block_table.key_size()),count());
+				found = count();
+				flip_index = 0;
+				m_table.insert(m_table.end(),block.begin(),block.end());
+			}
+			m_map.push_back(found.value() | (flip_index << 10) | palet);
+		}
+	}
+}
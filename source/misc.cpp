@@ -4,11 +4,30 @@
 #include <algorithm>
 #include <deque>
 
-#define TWIDTAB(x) ( (x&1)|((x&2)<<1)|((x&4)<<2)|((x&8)<<3)|((x&16)<<4)| \
-                     ((x&32)<<5)|((x&64)<<6)|((x&128)<<7)|((x&256)<<8)|((x&512)<<9) )
-#define TWIDOUT(x, y) ( TWIDTAB((y)) | (TWIDTAB((x)) << 1) )
 #define MIN(a, b) ( (a)<(b)? (a):(b) )
 
+namespace {
+	// spreads a byte's bits out to the even bits of a short
+	constexpr auto twiddle_spreadTable() -> std::array<uint16_t,256> {
+		std::array<uint16_t,256> table = {};
+		for(int i=0; i<256; i++) {
+			uint16_t spread = 0;
+			for(int b=0; b<8; b++) spread |= ((i>>b) & 1) << (b*2);
+			table[i] = spread;
+		}
+		return table;
+	}
+	constexpr auto TWIDDLE_SPREAD = twiddle_spreadTable();
+
+	constexpr auto twiddle_spread(uint32_t v) -> uint32_t {
+		return TWIDDLE_SPREAD[v & 0xFF] | (uint32_t(TWIDDLE_SPREAD[(v>>8) & 0xFF]) << 16);
+	}
+	// offset within a square block: y takes the even bits, x the odd ones
+	constexpr auto twiddle_morton(uint32_t x, uint32_t y) -> uint32_t {
+		return twiddle_spread(y) | (twiddle_spread(x) << 1);
+	}
+};
+
 namespace SPDCommand {
 	enum {
 		Raw,
@@ -368,88 +387,46 @@ auto aya::conv_po2(int n) -> int {
 	return power;
 }
 
+auto aya::tilekey_size(int width, int height, int bpp) -> size_t {
+	const size_t num_dots = width * height;
+	if(bpp > 8) return num_dots * 4;
+	return (num_dots*bpp + 7) / 8;
+}
+
 auto aya::marisa_graphfmt::getBPP(int format) -> int {
-	auto format_id = marisa_graphfmt::getID(format);
 	if(!marisa_graphfmt::isValid(format)) {
 		puts("imgconnv::marisa_graphfmt_getBPP(fmt): error: invalid format");
 		std::exit(-1);
 	}
-
-	int bpp = 0;
-	switch(format_id) {
-		case marisa_graphfmt::i4: { bpp = 4; break; }
-		case marisa_graphfmt::i8: { bpp = 8; break; }
-		case marisa_graphfmt::rgb565:
-		case marisa_graphfmt::rgb5a1:
-		case marisa_graphfmt::argb4444: {
-			bpp = 16;
-			break;
-		}
-		default: break;
-	}
-	return bpp;
+	return formats::bpp[getID(format)];
 }
 auto aya::patchu_graphfmt::getBPP(int format) -> int {
-	auto format_id = patchu_graphfmt::getID(format);
 	if(!patchu_graphfmt::isValid(format)) {
 		puts("aya::patchu_graphfmt_getBPP(fmt): error: invalid format");
 		std::exit(-1);
 	}
-
-	int bpp = 0;
-	switch(format_id) {
-		case patchu_graphfmt::i4: { bpp = 4; break; }
-		case patchu_graphfmt::i8: { bpp = 8; break; }
-		case patchu_graphfmt::rgb565:
-		case patchu_graphfmt::rgb5a1:
-		case patchu_graphfmt::argb4: {
-			bpp = 16;
-			break;
-		}
-		case patchu_graphfmt::argb8: { bpp = 32; break; }
-		default: break;
-	}
-	return bpp;
+	return formats::bpp[getID(format)];
 }
 auto aya::narumi_graphfmt::getBPP(int format) -> int {
-	auto format_id = narumi_graphfmt::getID(format);
 	if(!narumi_graphfmt::isValid(format)) {
 		puts("aya::narumi_graphfmt_getBPP(fmt): error: invalid format");
 		std::exit(-1);
 	}
-
-	const std::map<int,int> bpp_table = {
-		{ i4, 4 },
-		{ i8, 8 },
-		{ rgb, 16 },
-	};
-	return bpp_table.at(format_id);
+	return formats::bpp[getID(format)];
 }
 auto aya::alice_graphfmt::getBPP(int format) -> int {
-	auto format_id = getID(format);
-	if(!isValid(format)) {
+	if(!alice_graphfmt::isValid(format)) {
 		puts("aya::alice_graphfmt_getBPP(fmt): error: invalid format");
 		std::exit(-1);
 	}
-
-	const std::map<int,int> bpp_table = {
-		{ i4, 4 },
-		{ i8, 8 },
-		{ rgb, 16 },
-	};
-	return bpp_table.at(format_id);
+	return formats::bpp[getID(format)];
 }
 auto aya::hourai_graphfmt::getBPP(int format) -> int {
-	auto format_id = hourai_graphfmt::getID(format);
 	if(!hourai_graphfmt::isValid(format)) {
 		puts("aya::hourai_graphfmt_getBPP(fmt): error: invalid format");
 		std::exit(-1);
 	}
-
-	const std::map<int,int> bpp_table = {
-		{ i2, 2 },
-	};
-	return bpp_table.at(format_id);
+	return formats::bpp[getID(format)];
 }
 
 namespace aya::util {
@@ -465,6 +442,11 @@ namespace aya::util {
 
 		return ver;
 	}
+	auto thread_count() -> int {
+		// hardware_concurrency() may be 0 if it can't tell
+		static const int count = std::max<int>(1,std::thread::hardware_concurrency());
+		return count;
+	}
 };
 
 // https://github.com/KallistiOS/KallistiOS/blob/master/utils/kmgenc/kmgenc.c
@@ -472,15 +454,35 @@ namespace aya::util {
 auto aya::twiddled_index(int x, int y, int w, int h) -> size_t {
 	int min = MIN(w,h);
 	int mask = min - 1;
-	int z = TWIDOUT(x & mask,y & mask);
-	z += (x / min + y / min) * min * min;
+	size_t z = twiddle_morton(x & mask,y & mask);
+	z += size_t(x / min + y / min) * min * min;
 	return z;
 }
 auto aya::twiddled_index4b(int x, int y, int w, int h) -> size_t {
 	int min = MIN(w,h);
 	int mask = min - 1;
-	int z = TWIDOUT((x & mask) / 4,(y & mask));
-	z += (x / min + y / min) * min * min;
+	size_t z = twiddle_morton((x & mask) / 4,(y & mask));
+	z += size_t(x / min + y / min) * min * min;
 	return z;
 }
+auto aya::twiddled_rowIndices(int y, int w, int h, size_t* indices) -> void {
+	/*
+	 * twiddled_index() for every dot in row <y>. rather than spreading
+	 * each x again, the x bits are stepped with a morton increment:
+	 * subtracting the x-bit mask fills the y-bit gaps with 1s, so the +1
+	 * carries straight through them. it wraps to 0 at each block's end.
+	*/
+	const int min = MIN(w,h);
+	const uint32_t mask = min - 1;
+	const uint32_t x_bits = twiddle_morton(mask,0);
+	const uint32_t y_part = twiddle_morton(0,y & mask);
+	const size_t y_block = y / min;
+	const size_t block_size = size_t(min) * min;
+
+	uint32_t x_part = 0;
+	for(int x=0; x<w; x++) {
+		indices[x] = ((x / min + y_block) * block_size) + (y_part | x_part);
+		x_part = (x_part - x_bits) & x_bits;
+	}
+}
 
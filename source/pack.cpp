@@ -0,0 +1,173 @@
+#include <aya.h>
+#include <cstring>
+#include <algorithm>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define AYA_PACK_AVX2
+#endif
+
+/*
+ * row packing kernels for indexed formats. a dot's pen number lives in its
+ * alpha byte, which is the first byte of every 4-byte CColor; all of the
+ * kernels start by pulling those out into a plain byte row ("pens").
+ * AVX2 is picked at runtime, since the default build doesn't enable it.
+*/
+
+namespace {
+	constexpr size_t PACK_CHUNK = 256; // dots per pens pass
+
+	auto pens_getScalar(const aya::CColor* dots, uint8_t* pens, size_t len) -> void {
+		for(size_t i=0; i<len; i++) pens[i] = dots[i].a;
+	}
+
+#if defined(__SSE2__)
+	auto pens_getSSE2(const aya::CColor* dots, uint8_t* pens, size_t len) -> void {
+		const __m128i mask = _mm_set1_epi32(0xFF);
+		size_t i = 0;
+		for(; i+16 <= len; i += 16) {
+			const __m128i *src = reinterpret_cast<const __m128i*>(dots + i);
+			const __m128i d0 = _mm_and_si128(_mm_loadu_si128(src + 0),mask);
+			const __m128i d1 = _mm_and_si128(_mm_loadu_si128(src + 1),mask);
+			const __m128i d2 = _mm_and_si128(_mm_loadu_si128(src + 2),mask);
+			const __m128i d3 = _mm_and_si128(_mm_loadu_si128(src + 3),mask);
+			const __m128i p = _mm_packus_epi16(_mm_packs_epi32(d0,d1),_mm_packs_epi32(d2,d3));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(pens + i),p);
+		}
+		pens_getScalar(dots + i,pens + i,len - i);
+	}
+#endif
+
+#if defined(AYA_PACK_AVX2)
+	__attribute__((target("avx2")))
+	auto pens_getAVX2(const aya::CColor* dots, uint8_t* pens, size_t len) -> void {
+		const __m256i mask = _mm256_set1_epi32(0xFF);
+		// packs work per 128-bit lane, so the dwords come out as
+		// a0-3,b0-3,c0-3,d0-3 | a4-7,b4-7,c4-7,d4-7
+		const __m256i order = _mm256_setr_epi32(0,4,1,5,2,6,3,7);
+		size_t i = 0;
+		for(; i+32 <= len; i += 32) {
+			const __m256i *src = reinterpret_cast<const __m256i*>(dots + i);
+			const __m256i d0 = _mm256_and_si256(_mm256_loadu_si256(src + 0),mask);
+			const __m256i d1 = _mm256_and_si256(_mm256_loadu_si256(src + 1),mask);
+			const __m256i d2 = _mm256_and_si256(_mm256_loadu_si256(src + 2),mask);
+			const __m256i d3 = _mm256_and_si256(_mm256_loadu_si256(src + 3),mask);
+			__m256i p = _mm256_packus_epi16(_mm256_packs_epi32(d0,d1),_mm256_packs_epi32(d2,d3));
+			p = _mm256_permutevar8x32_epi32(p,order);
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(pens + i),p);
+		}
+		pens_getScalar(dots + i,pens + i,len - i);
+	}
+#endif
+
+	using pens_fn = void(*)(const aya::CColor*, uint8_t*, size_t);
+	auto pens_pick() -> pens_fn {
+#if defined(AYA_PACK_AVX2)
+		__builtin_cpu_init(); // runs before main, so has to be done by hand
+		if(__builtin_cpu_supports("avx2")) return pens_getAVX2;
+#endif
+#if defined(__SSE2__)
+		return pens_getSSE2;
+#else
+		return pens_getScalar;
+#endif
+	}
+	const pens_fn pens_get = pens_pick();
+
+	// pens -> nibbles ------------------------------------------@/
+	auto nibbles_packScalar(const uint8_t* pens, uint8_t* out, size_t len, bool low_first) -> void {
+		for(size_t i=0; i<len; i += 2) {
+			const uint8_t dotA = pens[i] & 0xF;
+			const uint8_t dotB = (i+1 < len) ? (pens[i+1] & 0xF) : 0;
+			out[i/2] = low_first ? (dotA | (dotB<<4)) : (dotB | (dotA<<4));
+		}
+	}
+	auto nibbles_pack(const uint8_t* pens, uint8_t* out, size_t len, bool low_first) -> void {
+		size_t i = 0;
+#if defined(__SSE2__)
+		// as 16-bit lanes, each pair of pens is A | B<<8
+		const __m128i lowmask = _mm_set1_epi16(0x000F);
+		const __m128i highmask = _mm_set1_epi16(0x00F0);
+		for(; i+32 <= len; i += 32) {
+			const __m128i pA = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pens + i));
+			const __m128i pB = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pens + i + 16));
+			__m128i wA,wB;
+			if(low_first) {
+				wA = _mm_or_si128(_mm_and_si128(pA,lowmask),_mm_and_si128(_mm_srli_epi16(pA,4),highmask));
+				wB = _mm_or_si128(_mm_and_si128(pB,lowmask),_mm_and_si128(_mm_srli_epi16(pB,4),highmask));
+			} else {
+				wA = _mm_or_si128(_mm_and_si128(_mm_slli_epi16(pA,4),highmask),_mm_and_si128(_mm_srli_epi16(pA,8),lowmask));
+				wB = _mm_or_si128(_mm_and_si128(_mm_slli_epi16(pB,4),highmask),_mm_and_si128(_mm_srli_epi16(pB,8),lowmask));
+			}
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(out + i/2),_mm_packus_epi16(wA,wB));
+		}
+#endif
+		nibbles_packScalar(pens + i,out + i/2,len - i,low_first);
+	}
+
+	// pens -> gb bitplanes -------------------------------------@/
+	constexpr auto bits_reverseTable() -> std::array<uint8_t,256> {
+		std::array<uint8_t,256> table = {};
+		for(int i=0; i<256; i++) {
+			int rev = 0;
+			for(int b=0; b<8; b++) rev |= ((i>>b) & 1) << (7-b);
+			table[i] = rev;
+		}
+		return table;
+	}
+	constexpr auto BITS_REVERSE = bits_reverseTable();
+
+	auto planes_packScalar(const uint8_t* pens, uint8_t* out, size_t len) -> void {
+		for(size_t i=0; i<len; i += 8) {
+			uint8_t plane0 = 0;
+			uint8_t plane1 = 0;
+			for(size_t o=0; o<8 && i+o<len; o++) {
+				const auto dot = pens[i+o] & 3;
+				plane0 |= (dot&1) << (7-o);
+				plane1 |= (dot>>1) << (7-o);
+			}
+			*out++ = plane0;
+			*out++ = plane1;
+		}
+	}
+	auto planes_pack(const uint8_t* pens, uint8_t* out, size_t len) -> void {
+		size_t i = 0;
+#if defined(__SSE2__)
+		// movemask takes each byte's top bit, with the 1st dot in bit 0;
+		// the gb wants the 1st dot in bit 7, hence the reverse table.
+		for(; i+16 <= len; i += 16) {
+			const __m128i p = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pens + i));
+			const int mask0 = _mm_movemask_epi8(_mm_slli_epi16(p,7));
+			const int mask1 = _mm_movemask_epi8(_mm_slli_epi16(p,6));
+			out[(i/4) + 0] = BITS_REVERSE[mask0 & 0xFF];
+			out[(i/4) + 1] = BITS_REVERSE[mask1 & 0xFF];
+			out[(i/4) + 2] = BITS_REVERSE[mask0 >> 8];
+			out[(i/4) + 3] = BITS_REVERSE[mask1 >> 8];
+		}
+#endif
+		planes_packScalar(pens + i,out + i/4,len - i);
+	}
+};
+
+auto aya::pack::row_i8(const aya::CColor* dots, uint8_t* out, size_t len) -> void {
+	pens_get(dots,out,len);
+}
+auto aya::pack::row_i4(const aya::CColor* dots, uint8_t* out, size_t len, bool low_first) -> void {
+	uint8_t pens[PACK_CHUNK];
+	for(size_t i=0; i<len; i += PACK_CHUNK) {
+		const size_t chunk = std::min(PACK_CHUNK,len - i);
+		pens_get(dots + i,pens,chunk);
+		nibbles_pack(pens,out + i/2,chunk,low_first);
+	}
+}
+auto aya::pack::row_i2planar(const aya::CColor* dots, uint8_t* out, size_t len) -> void {
+	uint8_t pens[PACK_CHUNK];
+	for(size_t i=0; i<len; i += PACK_CHUNK) {
+		const size_t chunk = std::min(PACK_CHUNK,len - i);
+		pens_get(dots + i,pens,chunk);
+		planes_pack(pens,out + i/4,chunk);
+	}
+}
@@ -1,6 +1,260 @@
 #include <aya.h>
 #include <lodepng.h>
 #include <stdexcept>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace {
+	constexpr int PNG_BAND_HEIGHT = 8;
+
+	// checks if every dot in a span has the same in-memory value as <color>
+	auto dots_allEqual(const aya::CColor* dots, size_t len, aya::CColor color) -> bool {
+		uint32_t word = 0;
+		std::memcpy(&word,&color,sizeof(word));
+
+		size_t i = 0;
+#if defined(__SSE2__)
+		const __m128i ref = _mm_set1_epi32(word);
+		for(; i+8 <= len; i += 8) {
+			const __m128i dotsA = _mm_loadu_si128(reinterpret_cast<const __m128i*>(dots + i));
+			const __m128i dotsB = _mm_loadu_si128(reinterpret_cast<const __m128i*>(dots + i + 4));
+			const __m128i eq = _mm_and_si128(
+				_mm_cmpeq_epi32(dotsA,ref),
+				_mm_cmpeq_epi32(dotsB,ref)
+			);
+			if(_mm_movemask_epi8(eq) != 0xFFFF) return false;
+		}
+#endif
+		for(; i<len; i++) {
+			uint32_t dot = 0;
+			std::memcpy(&dot,dots + i,sizeof(dot));
+			if(dot != word) return false;
+		}
+		return true;
+	}
+
+	// unpacks <len> MSB-first 1/2/4/8-bit indices, starting <bit_offset> bits
+	// into <src>, to one byte per index.
+	auto row_unpackIndices(const uint8_t* src, size_t bit_offset, int bpp,
+		uint8_t* indices, size_t len
+	) -> void {
+		if(bpp == 8) {
+			std::memcpy(indices,src + (bit_offset/8),len);
+			return;
+		}
+
+		const uint8_t mask = (1u<<bpp) - 1;
+		size_t i = 0;
+		// leading indices until the source is byte-aligned
+		for(; i<len && (bit_offset & 7); i++, bit_offset += bpp) {
+			const int shift = 8 - bpp - (bit_offset & 7);
+			indices[i] = (src[bit_offset/8] >> shift) & mask;
+		}
+		// whole source bytes
+		const int per_byte = 8 / bpp;
+		const uint8_t *srcbyte = src + (bit_offset/8);
+		for(; i+per_byte <= len; i += per_byte) {
+			const uint8_t packed = *srcbyte++;
+			for(int n=0; n<per_byte; n++) {
+				indices[i + n] = (packed >> (8 - bpp*(n+1))) & mask;
+			}
+		}
+		// trailing indices in a partial byte
+		for(int n=0; i<len; i++, n++) {
+			indices[i] = (*srcbyte >> (8 - bpp*(n+1))) & mask;
+		}
+	}
+
+	// expands one row of palette indices to colors through a 256-entry LUT
+	auto row_expandPalette(const uint8_t* indices, aya::CColor* dots, size_t len,
+		const std::array<aya::CColor,256>& lut
+	) -> void {
+		for(size_t i=0; i<len; i++) {
+			dots[i] = lut[indices[i]];
+		}
+	}
+
+	// decodes one png scanline, starting <bit_offset> bits into <src>.
+	// palette images give pen numbers if <paletted>, or their colors if not.
+	auto row_decode(const aya::CPNGInfo& info, const uint8_t* src, size_t bit_offset,
+		aya::CColor* dots, uint8_t* scratch, const std::array<aya::CColor,256>& lut,
+		bool paletted
+	) -> void {
+		const size_t len = info.width;
+		const int depth = info.bitdepth;
+
+		if(info.colortype == aya::PNGColorType::Palette) {
+			row_unpackIndices(src,bit_offset,depth,scratch,len);
+			if(paletted) {
+				for(size_t i=0; i<len; i++) dots[i] = aya::CColor(scratch[i]);
+			} else {
+				row_expandPalette(scratch,dots,len,lut);
+			}
+			return;
+		}
+
+		// low-bit gray is scaled up to the full 0-255 range
+		if(info.colortype == aya::PNGColorType::Gray && depth < 8) {
+			row_unpackIndices(src,bit_offset,depth,scratch,len);
+			const int scale = 255 / ((1<<depth) - 1);
+			for(size_t i=0; i<len; i++) {
+				const uint8_t v = scratch[i] * scale;
+				const bool keyed = info.key_defined && scratch[i] == info.key_r;
+				dots[i] = aya::CColor(keyed ? 0 : 0xFF,v,v,v);
+			}
+			return;
+		}
+
+		// 8/16-bit samples; 16-bit ones keep only their high byte
+		const uint8_t *row = src + (bit_offset/8);
+		const int channels = info.dot_bits() / depth;
+		const int step = depth / 8;
+		auto sample = [&](size_t i, int c) -> uint16_t {
+			const uint8_t *s = row + ((i*channels + c) * step);
+			return step == 2 ? (uint16_t(s[0])<<8) | s[1] : s[0];
+		};
+		auto to8 = [&](uint16_t v) -> uint8_t { return step == 2 ? v >> 8 : v; };
+
+		for(size_t i=0; i<len; i++) {
+			switch(info.colortype) {
+				case aya::PNGColorType::Gray: {
+					const uint16_t v = sample(i,0);
+					const bool keyed = info.key_defined && v == info.key_r;
+					dots[i] = aya::CColor(keyed ? 0 : 0xFF,to8(v),to8(v),to8(v));
+					break;
+				}
+				case aya::PNGColorType::RGB: {
+					const uint16_t r = sample(i,0), g = sample(i,1), b = sample(i,2);
+					const bool keyed = info.key_defined
+						&& r == info.key_r && g == info.key_g && b == info.key_b;
+					dots[i] = aya::CColor(keyed ? 0 : 0xFF,to8(r),to8(g),to8(b));
+					break;
+				}
+				case aya::PNGColorType::GrayAlpha: {
+					const uint8_t v = to8(sample(i,0));
+					dots[i] = aya::CColor(to8(sample(i,1)),v,v,v);
+					break;
+				}
+				case aya::PNGColorType::RGBA: {
+					dots[i] = aya::CColor(to8(sample(i,3)),
+						to8(sample(i,0)),to8(sample(i,1)),to8(sample(i,2))
+					);
+					break;
+				}
+			}
+		}
+	}
+
+	// packers, specialized per format --------------------------@/
+	template<typename Traits>
+	auto row_pack(const aya::CColor* dots, uint8_t* out, size_t len) -> void {
+		using namespace aya::pixfmt;
+		if constexpr(Traits::layout == Layout::Planar) {
+			static_assert(Traits::bpp == 2, "only gb 2bpp is planar");
+			aya::pack::row_i2planar(dots,out,len);
+		} else if constexpr(Traits::is_indexed && Traits::bpp == 4) {
+			aya::pack::row_i4(dots,out,len,Traits::nibble_order == NibbleOrder::LowFirst);
+		} else if constexpr(Traits::is_indexed) {
+			static_assert(Traits::bpp == 8, "unhandled indexed bpp");
+			aya::pack::row_i8(dots,out,len);
+		} else if constexpr(Traits::encoding == Encoding::RGB565) {
+			aya::pack::row_rgb565(dots,out,len);
+		} else if constexpr(Traits::encoding == Encoding::RGB5A1) {
+			aya::pack::row_rgb5a1(dots,out,len);
+		} else if constexpr(Traits::encoding == Encoding::ARGB4) {
+			aya::pack::row_argb4(dots,out,len);
+		} else if constexpr(Traits::encoding == Encoding::ARGB8) {
+			aya::pack::row_argb8(dots,out,len);
+		} else if constexpr(Traits::encoding == Encoding::RGB5A1Sat) {
+			static_assert(Traits::endian == Endian::Big);
+			aya::pack::row_rgb5a1Sat(dots,out,len,true);
+		} else if constexpr(Traits::encoding == Encoding::RGB5A1Agb) {
+			aya::pack::row_rgb5a1Agb(dots,out,len);
+		} else {
+			static_assert(sizeof(Traits) == 0, "unhandled pixel format");
+		}
+	}
+
+	template<typename Traits>
+	auto image_pack(const aya::CColor* dots, int width, int height, aya::CPixelWriter& writer) -> void {
+		// rows that end on a byte boundary sit back to back in both the
+		// photo & the output, so the whole image can go as one long row.
+		if(writer.stride() * 8 == size_t(width) * Traits::bpp) {
+			row_pack<Traits>(dots,writer.data(),size_t(width) * height);
+			return;
+		}
+		for(int iy=0; iy<height; iy++) {
+			row_pack<Traits>(dots + (size_t(iy) * width),writer.row_get(iy),width);
+		}
+	}
+
+	// mipmap filtering ---------------------------------@/
+	// levels are filtered as premultiplied, linear-light argb floats, so
+	// averaging doesn't darken mid-tones or bleed transparent dots' colors.
+	auto srgb_toLinear(uint8_t value) -> float {
+		static const auto table = []() {
+			std::array<float,256> values;
+			for(int i=0; i<256; i++) {
+				const float v = i / 255.0f;
+				values[i] = (v <= 0.04045f) ? (v / 12.92f) : std::pow((v + 0.055f) / 1.055f,2.4f);
+			}
+			return values;
+		}();
+		return table[value];
+	}
+	auto linear_toSRGB(float value) -> uint8_t {
+		value = std::clamp(value,0.0f,1.0f);
+		const float v = (value <= 0.0031308f) ? (value * 12.92f) : (1.055f * std::pow(value,1.0f / 2.4f) - 0.055f);
+		return std::lround(v * 255.0f);
+	}
+
+	auto dot_toLinear(const aya::CColor& dot, float* out) -> void {
+		const float alpha = dot.a / 255.0f;
+		out[0] = alpha;
+		out[1] = srgb_toLinear(dot.r) * alpha;
+		out[2] = srgb_toLinear(dot.g) * alpha;
+		out[3] = srgb_toLinear(dot.b) * alpha;
+	}
+	auto dot_fromLinear(const float* dot) -> aya::CColor {
+		const float alpha = dot[0];
+		if(alpha <= 0.0f) return aya::CColor();
+		return aya::CColor(
+			std::lround(std::clamp(alpha,0.0f,1.0f) * 255.0f),
+			linear_toSRGB(dot[1] / alpha),
+			linear_toSRGB(dot[2] / alpha),
+			linear_toSRGB(dot[3] / alpha)
+		);
+	}
+
+	// 2x2 box filter, <size>x<size> -> <size/2>x<size/2>
+	auto level_halve(const std::vector<float>& src, int size, std::vector<float>& dst) -> void {
+		const int half = size / 2;
+		dst.resize(size_t(half) * half * 4);
+		for(int y=0; y<half; y++) {
+			const float *row_a = src.data() + (size_t(y*2) * size * 4);
+			const float *row_b = row_a + (size_t(size) * 4);
+			float *out = dst.data() + (size_t(y) * half * 4);
+			for(int x=0; x<half; x++) {
+#if defined(__SSE2__)
+				const __m128 sum = _mm_add_ps(
+					_mm_add_ps(_mm_loadu_ps(row_a + x*8),_mm_loadu_ps(row_a + x*8 + 4)),
+					_mm_add_ps(_mm_loadu_ps(row_b + x*8),_mm_loadu_ps(row_b + x*8 + 4))
+				);
+				_mm_storeu_ps(out + x*4,_mm_mul_ps(sum,_mm_set1_ps(0.25f)));
+#else
+				for(int c=0; c<4; c++) {
+					out[x*4 + c] = (row_a[x*8 + c] + row_a[x*8 + 4 + c] + row_b[x*8 + c] + row_b[x*8 + 4 + c]) * 0.25f;
+				}
+#endif
+			}
+		}
+	}
+};
 
 namespace aya {
 	CPhoto::CPhoto() {
@@ -17,106 +271,80 @@ namespace aya {
 	CPhoto::CPhoto(std::string filename,bool paletted, bool opaque_pal) {
 		// TODO: check superfamiconv to see how they deal with lodepng,
 		// as lodepng's actual """documentation""" is DOGSHIT
-		// load image -----------------------------------@/
-		std::vector<uint8_t> img_bufferFile;
-		std::vector<uint8_t> img_bufferBMP;
-		unsigned int out_w = 0;
-		unsigned int out_h = 0;
-		lodepng::State state;
-		state.decoder.color_convert = false;
-		state.decoder.ignore_crc = true;
-	//	auto filetype = FreeImage_GetFileType(filename.c_str(),0);
-	//	auto fbmp = FreeImage_Load(filetype,filename.c_str());
-	
-		unsigned int load_error = lodepng::load_file(img_bufferFile, filename);
-		if (load_error) throw std::runtime_error(lodepng_error_text(load_error));
-		load_error = lodepng::decode(img_bufferBMP,out_w,out_h,state,img_bufferFile);
-		if (load_error) throw std::runtime_error(lodepng_error_text(load_error));
-
-		/*if(!fbmp) {
-			std::printf("aya::CPhoto::CPhoto(fname,pal): error: unable to read file %s\n",
-				filename.c_str()
-			);
-			std::exit(-1);
-		}*/
+		// open image -----------------------------------@/
+		aya::CPNGBandReader reader(filename);
+		const aya::CPNGInfo& info = reader.info();
 
-		if(!paletted) {
-		//	fbmp = FreeImage_ConvertTo32Bits(fbmp);
-		//	std::puts("unhandled");
-		//	std::exit(-1);
+		// interlaced pngs' rows can't be read in order, so lodepng has to
+		// decode those in one go instead.
+		std::vector<uint8_t> img_bufferBMP;
+		if(!reader.is_streamable()) {
+			std::vector<uint8_t> img_bufferFile;
+			unsigned int out_w = 0;
+			unsigned int out_h = 0;
+			lodepng::State state;
+			state.decoder.color_convert = false;
+			state.decoder.ignore_crc = true;
+
+			unsigned int load_error = lodepng::load_file(img_bufferFile, filename);
+			if (load_error) throw std::runtime_error(lodepng_error_text(load_error));
+			load_error = lodepng::decode(img_bufferBMP,out_w,out_h,state,img_bufferFile);
+			if (load_error) throw std::runtime_error(lodepng_error_text(load_error));
 		}
 
-		/*if(!fbmp) {
-			std::printf("aya::CPhoto::CPhoto(fname,pal): error: unable to convert '%s' to 32-bit\n",
+		if(paletted && info.colortype != aya::PNGColorType::Palette) {
+			std::printf("aya::CPhoto::CPhoto(fname,pal): error: image %s has no palette\n",
 				filename.c_str()
 			);
 			std::exit(-1);
-		}*/
+		}
 
 		// set picture data -----------------------------@/
-	//	m_width = FreeImage_GetWidth(fbmp);
-	//	m_height = FreeImage_GetHeight(fbmp);
-		m_width = out_w;
-		m_height = out_h;
+		m_width = info.width;
+		m_height = info.height;
 		m_bmpdata = std::vector<aya::CColor>(dimensions());
 		m_palette = std::array<aya::CColor,256>();
 		palet_clear(aya::CColor());
 		clear(aya::CColor());
 
-		if(!paletted) {
-			if(state.info_raw.colortype == LCT_PALETTE) {
-				std::printf("aya::CPhoto::CPhoto(fname,pal): unhandled: have to do palette -> RGB conversion\n");
-				std::exit(-1);
-			} else {
-				for(int i=0; i<img_bufferBMP.size(); i += 4) {
-					int r = img_bufferBMP.at(i + 0);
-					int g = img_bufferBMP.at(i + 1);
-					int b = img_bufferBMP.at(i + 2);
-					int a = img_bufferBMP.at(i + 3);
-					m_bmpdata.at(i/4) = aya::CColor(a,r,g,b);
+		// get palette ----------------------------------@/
+		// out-of-range indices map to opaque black, like lodepng's
+		// own RGBA conversion does.
+		std::array<aya::CColor,256> lut;
+		lut.fill(aya::CColor(0xFF,0,0,0));
+		for(int i=0; i<info.palettesize; i++) {
+			lut[i] = info.palette[i];
+			palet_getRaw(i) = info.palette[i];
+			if(paletted) palet_getRaw(i).a = 0xFF;
+		}
+		if(paletted) palet_getRaw(0).a = 0; // transparent 1st color
+
+		// read from image ------------------------------@/
+		std::vector<uint8_t> img_bufferRow(m_width);
+		auto row_read = [&](const uint8_t* src, size_t bit_offset, int iy) {
+			row_decode(info,src,bit_offset,&dot_getRaw(0,iy),
+				img_bufferRow.data(),lut,paletted
+			);
+		};
+
+		if(reader.is_streamable()) {
+			std::vector<uint8_t> img_bufferBand;
+			const size_t stride = info.row_stride();
+			for(int band_y=0; reader.rows_left() > 0;) {
+				const int rows = reader.band_read(img_bufferBand,PNG_BAND_HEIGHT);
+				for(int iy=0; iy<rows; iy++) {
+					row_read(img_bufferBand.data() + (iy * stride),0,band_y + iy);
 				}
+				band_y += rows;
 			}
 		} else {
-			//RGBQUAD* src_pal = FreeImage_GetPalette(fbmp);
-			if(state.info_raw.colortype != LCT_PALETTE) {
-			//if(!src_pal) {
-				std::printf("aya::CPhoto::CPhoto(fname,pal): error: image %s has no palette\n",
-					filename.c_str()
-				);
-				std::exit(-1);
-			}
-
-			// get palette ------------------------------@/
-			for(int i=0; i<state.info_raw.palettesize * 4; i += 4) {
-				/*auto fclr = src_pal[i];
-				palet_getRaw(i) = aya::CColor(
-					0xFF,
-					fclr.rgbRed,
-					fclr.rgbGreen,
-					fclr.rgbBlue
-				);*/
-				palet_getRaw(i/4) = aya::CColor(
-					0xFF,
-					state.info_raw.palette[i + 0],
-					state.info_raw.palette[i + 1],
-					state.info_raw.palette[i + 2]
-				);
-			}
-			palet_getRaw(0).a = 0; // transparent 1st color
-
-			// read from image --------------------------@/
+			// lodepng leaves the rows as one continuous bitstream, with
+			// no padding between rows below 8 bits.
+			const size_t row_bits = size_t(m_width) * info.dot_bits();
 			for(int iy=0; iy<height(); iy++) {
-				for(int ix=0; ix<width(); ix++) {
-				//	BYTE index = 0;
-				//	FreeImage_GetPixelIndex(fbmp,ix,height()-iy-1,&index);
-				//	dot_getRaw(ix,iy) = aya::CColor(index);
-					const size_t index = ix + (iy * width());
-					dot_getRaw(ix,iy) = aya::CColor(img_bufferBMP.at(index));
-				}
+				row_read(img_bufferBMP.data(),iy * row_bits,iy);
 			}
 		}
-
-		// FreeImage_Unload(fbmp);
 	}
 	CPhoto::CPhoto(int newwidth, int newheight) {
 		if(newwidth * newheight == 0) {
@@ -342,12 +570,87 @@ namespace aya {
 		return new_pic;
 	}
 	auto CPhoto::all_equals(aya::CColor color) const -> bool {
-		for(int i=0; i<m_bmpdata.size(); i++) {
-			if(m_bmpdata[i].rawdata() != color.rawdata()) return false;
+		return dots_allEqual(m_bmpdata.data(),m_bmpdata.size(),color);
+	}
+	auto CPhoto::rect_isZero(int x, int y, int w, int h) const -> bool {
+		auto inrange_x = dot_inRange(x,y) && dot_inRange(x+w-1,y);
+		auto inrange_y = dot_inRange(x,y+h-1) && dot_inRange(x+w-1,y+h-1);
+		if( !(inrange_x && inrange_y) ) {
+			std::puts("aya::CPhoto::rect_isZero(x,y,w,h): error: size/pos out of range");
+			std::exit(-1);
+		}
+
+		for(int iy=0; iy<h; iy++) {
+			if(!dots_allEqual(&dot_getRawC(x,y+iy),w,aya::CColor())) return false;
 		}
 		return true;
 	}
 
+	// tile occupancy -------------------------------------------------------@/
+	CTileOccupancy::CTileOccupancy() {
+		m_tileW = 0;
+		m_tileH = 0;
+		m_gridW = 0;
+		m_gridH = 0;
+		m_sat = std::vector<uint32_t>(1,0);
+	}
+	CTileOccupancy::CTileOccupancy(const CPhoto& photo, int tile_w, int tile_h) {
+		if(tile_w <= 0 || tile_h <= 0 || (photo.width()%tile_w) != 0 || (photo.height()%tile_h) != 0) {
+			std::printf("aya::CTileOccupancy::CTileOccupancy(): error: invalid tile size (%d,%d)\n",
+				tile_w,tile_h
+			);
+			std::exit(-1);
+		}
+
+		m_tileW = tile_w;
+		m_tileH = tile_h;
+		m_gridW = photo.width() / tile_w;
+		m_gridH = photo.height() / tile_h;
+
+		// mark used tiles ------------------------------@/
+		const size_t grid_area = m_gridW * m_gridH;
+		m_bitmap = std::vector<uint64_t>((grid_area + 63) / 64,0);
+		for(int ty=0; ty<m_gridH; ty++) {
+			for(int tx=0; tx<m_gridW; tx++) {
+				if(!photo.rect_isZero(tx*tile_w,ty*tile_h,tile_w,tile_h)) {
+					const size_t idx = tx + ty * m_gridW;
+					m_bitmap[idx/64] |= uint64_t(1) << (idx%64);
+				}
+			}
+		}
+
+		// build summed-area table ----------------------@/
+		const int sat_w = m_gridW + 1;
+		m_sat = std::vector<uint32_t>(sat_w * (m_gridH+1),0);
+		for(int ty=0; ty<m_gridH; ty++) {
+			uint32_t row_sum = 0;
+			for(int tx=0; tx<m_gridW; tx++) {
+				row_sum += tile_isEmpty(tx,ty) ? 0 : 1;
+				m_sat[(tx+1) + (ty+1)*sat_w] = m_sat[(tx+1) + ty*sat_w] + row_sum;
+			}
+		}
+	}
+
+	auto CTileOccupancy::tile_isEmpty(int x, int y) const -> bool {
+		if(x < 0 || x >= m_gridW || y < 0 || y >= m_gridH) {
+			std::printf("aya::CTileOccupancy::tile_isEmpty(): error: tile [%3d,%3d] out of range\n",
+				x,y
+			);
+			std::exit(-1);
+		}
+		const size_t idx = x + y * m_gridW;
+		return ((m_bitmap[idx/64] >> (idx%64)) & 1) == 0;
+	}
+	auto CTileOccupancy::rect_countUsed(int x, int y, int w, int h) const -> int {
+		if(x < 0 || y < 0 || w < 0 || h < 0 || x+w > m_gridW || y+h > m_gridH) {
+			std::printf("aya::CTileOccupancy::rect_countUsed(): error: rect [%3d,%3d,%3d,%3d] out of range\n",
+				x,y,w,h
+			);
+			std::exit(-1);
+		}
+		return sat_get(x+w,y+h) - sat_get(x,y+h) - sat_get(x+w,y) + sat_get(x,y);
+	}
+
 	auto CPhoto::hash_get(int flip) const -> uint64_t {
 		uint64_t hash = 0x811C9DC5;
 		
@@ -399,326 +702,293 @@ namespace aya {
 		return hash;
 	}
 
-	auto CPhoto::convert_rawPGI(int format) const -> scl::blob {
-		auto format_id = patchu_graphfmt::getID(format);
-		scl::blob blob_bmp;
-
-		switch(format_id) {
-			case patchu_graphfmt::i8: {
-				for(int iy=0; iy<height(); iy++) {
-					for(int ix=0; ix<width(); ix++) {
-						dot_getRawC(ix,iy).write_alpha(blob_bmp);
-					}
-				}		
-				break;
-			}
-			case patchu_graphfmt::rgb565: {
-				for(int iy=0; iy<height(); iy++) {
-					for(int ix=0; ix<width(); ix++) {
-						dot_getRawC(ix,iy).write_rgb565(blob_bmp);
-					}
-				}
-				break;
-			}
-			case patchu_graphfmt::rgb5a1: {
-				for(int iy=0; iy<height(); iy++) {
-					for(int ix=0; ix<width(); ix++) {
-						dot_getRawC(ix,iy).write_rgb5a1(blob_bmp);
-					}
-				}
-				break;
-			}
-			case patchu_graphfmt::argb4: {
-				for(int iy=0; iy<height(); iy++) {
-					for(int ix=0; ix<width(); ix++) {
-						dot_getRawC(ix,iy).write_argb4(blob_bmp);
-					}
-				}
-				break;
-			}
-			case patchu_graphfmt::argb8: {
-				for(int iy=0; iy<height(); iy++) {
-					for(int ix=0; ix<width(); ix++) {
-						dot_getRawC(ix,iy).write_argb8(blob_bmp);
-					}
+	auto CPhoto::key_get(int flip, int bpp) const -> std::vector<uint8_t> {
+		/*
+		 * packs the (flipped) image into a dedup key. indexed formats pack
+		 * each pen at <bpp> bits, low pixel first, so an 8x8 4bpp tile
+		 * becomes 32 bytes. anything above 8bpp uses the full ARGB color.
+		*/
+		std::vector<uint8_t> key(aya::tilekey_size(width(),height(),bpp),0);
+		
+		const int flip_x = (flip>>0)&1;
+		const int flip_y = (flip>>1)&1;
+
+		size_t pos = 0;
+		for(int ly=0; ly<height(); ly++) {
+			const int y = flip_y ? (height()-ly-1) : ly;
+			for(int lx=0; lx<width(); lx++) {
+				const int x = flip_x ? (width()-lx-1) : lx;
+				const auto& dot = dot_getRawC(x,y);
+				if(bpp > 8) {
+					const uint32_t raw = dot.rawdata();
+					key[pos++] = raw;
+					key[pos++] = raw>>8;
+					key[pos++] = raw>>16;
+					key[pos++] = raw>>24;
+				} else {
+					const uint32_t pen = dot.a & ((1<<bpp) - 1);
+					key[pos/8] |= pen << (pos%8);
+					pos += bpp;
 				}
-				break;
-			}
-			default: {
-				puts("aya::CPhoto::convert_raw(fmt): error: format not supported ^^;");
-				std::exit(-1);
-				break;
 			}
 		}
+		return key;
+	}
 
+	auto CPhoto::palet_getBank(int bank_size, bool skip_pen0) const -> int {
+		/*
+		 * which <bank_size>-color palette bank all of the image's pens are
+		 * in. with <skip_pen0>, pen 0 of every bank is transparent, so those
+		 * can go in any bank (not so on the cgb, where it's drawn).
+		 * 0 if no pens count, -1 if they're in more than one bank.
+		*/
+		int bank = -1;
+		for(const auto& dot : m_bmpdata) {
+			if(skip_pen0 && (dot.a % bank_size) == 0) continue;
+			const int dot_bank = dot.a / bank_size;
+			if(bank < 0) bank = dot_bank;
+			else if(bank != dot_bank) return -1;
+		}
+		return (bank < 0) ? 0 : bank;
+	}
+
+	auto CPhoto::convert_rawPGI(int format) const -> scl::blob {
+		scl::blob blob_bmp;
+		const bool format_ok = patchu_graphfmt::formats::visit(patchu_graphfmt::getID(format),[&](auto traits) {
+			using Traits = decltype(traits);
+			aya::CPixelWriter writer(Traits::bpp,width(),height(),Traits::layout == pixfmt::Layout::Planar);
+			image_pack<Traits>(m_bmpdata.data(),width(),height(),writer);
+			blob_bmp = writer.blob_get();
+		});
+
+		if(!format_ok) {
+			puts("aya::CPhoto::convert_rawPGI(fmt): error: format not supported ^^;");
+			std::exit(-1);
+		}
 		return blob_bmp;
 	}
 	auto CPhoto::convert_raw(int format) const -> scl::blob {
-		auto format_id = marisa_graphfmt::getID(format);
 		scl::blob blob_bmp;
-
-		switch(format_id) {
-			case marisa_graphfmt::i8: {
-				for(int iy=0; iy<height(); iy++) {
-					for(int ix=0; ix<width(); ix++) {
-						dot_getRawC(ix,iy).write_alpha(blob_bmp);
-					}
-				}		
-				break;
-			}
-			case marisa_graphfmt::rgb565: {
-				for(int iy=0; iy<height(); iy++) {
-					for(int ix=0; ix<width(); ix++) {
-						dot_getRawC(ix,iy).write_rgb565(blob_bmp);
-					}
-				}
-				break;
-			}
-			case marisa_graphfmt::rgb5a1: {
-				for(int iy=0; iy<height(); iy++) {
-					for(int ix=0; ix<width(); ix++) {
-						dot_getRawC(ix,iy).write_rgb5a1(blob_bmp);
-					}
-				}
-				break;
-			}
-			case marisa_graphfmt::argb4444: {
-				for(int iy=0; iy<height(); iy++) {
-					for(int ix=0; ix<width(); ix++) {
-						dot_getRawC(ix,iy).write_argb4(blob_bmp);
-					}
-				}
-				break;
-			}
-			default: {
-				puts("aya::CPhoto::convert_raw(fmt): error: format not supported ^^;");
-				std::exit(-1);
-				break;
-			}
+		const bool format_ok = marisa_graphfmt::formats::visit(marisa_graphfmt::getID(format),[&](auto traits) {
+			using Traits = decltype(traits);
+			aya::CPixelWriter writer(Traits::bpp,width(),height(),Traits::layout == pixfmt::Layout::Planar);
+			image_pack<Traits>(m_bmpdata.data(),width(),height(),writer);
+			blob_bmp = writer.blob_get();
+		});
+
+		if(!format_ok) {
+			puts("aya::CPhoto::convert_raw(fmt): error: format not supported ^^;");
+			std::exit(-1);
 		}
-
 		return blob_bmp;
 	}
 	auto CPhoto::convert_rawNGI(int format) const -> scl::blob {
-		auto format_id = narumi_graphfmt::getID(format);
 		scl::blob blob_bmp;
-
-		switch(format_id) {
-			case narumi_graphfmt::i4: {
-				for(int iy=0; iy<height(); iy++) {
-					for(int ix=0; ix<width(); ix += 2) {
-						auto dotA = dot_getRawC(ix,iy).a & 0xF;
-						auto dotB = dot_getRawC(ix+1,iy).a & 0xF;
-						
-						blob_bmp.write_u8(dotB | (dotA<<4));
-					}
-				}		
-				break;
-			}
-			case narumi_graphfmt::i8: {
-				for(int iy=0; iy<height(); iy++) {
-					for(int ix=0; ix<width(); ix++) {
-						dot_getRawC(ix,iy).write_alpha(blob_bmp);
-					}
-				}		
-				break;
-			}
-			case narumi_graphfmt::rgb: {
-				for(int iy=0; iy<height(); iy++) {
-					for(int ix=0; ix<width(); ix++) {
-						dot_getRawC(ix,iy).write_rgb5a1_sat(blob_bmp,true);
-					}
-				}
-				break;
-			}
-			default: {
-				puts("aya::CPhoto::convert_raw(fmt): error: format not supported ^^;");
-				std::exit(-1);
-				break;
-			}
+		const bool format_ok = narumi_graphfmt::formats::visit(narumi_graphfmt::getID(format),[&](auto traits) {
+			using Traits = decltype(traits);
+			aya::CPixelWriter writer(Traits::bpp,width(),height(),Traits::layout == pixfmt::Layout::Planar);
+			image_pack<Traits>(m_bmpdata.data(),width(),height(),writer);
+			blob_bmp = writer.blob_get();
+		});
+
+		if(!format_ok) {
+			puts("aya::CPhoto::convert_rawNGI(fmt): error: format not supported ^^;");
+			std::exit(-1);
 		}
-
 		return blob_bmp;
 	}
 	auto CPhoto::convert_rawAGI(int format) const -> scl::blob {
-		auto format_id = alice_graphfmt::getID(format);
 		scl::blob blob_bmp;
-
-		switch(format_id) {
-			case alice_graphfmt::i4: {
-				for(int iy=0; iy<height(); iy++) {
-					for(int ix=0; ix<width(); ix += 2) {
-						auto dotA = dot_getRawC(ix,iy).a & 0xF;
-						auto dotB = dot_getRawC(ix+1,iy).a & 0xF;
-						
-						blob_bmp.write_u8(dotA | (dotB<<4));
-					}
-				}		
-				break;
-			}
-			case alice_graphfmt::i8: {
-				for(int iy=0; iy<height(); iy++) {
-					for(int ix=0; ix<width(); ix++) {
-						dot_getRawC(ix,iy).write_alpha(blob_bmp);
-					}
-				}		
-				break;
-			}
-			case alice_graphfmt::rgb: {
-				for(int iy=0; iy<height(); iy++) {
-					for(int ix=0; ix<width(); ix++) {
-						dot_getRawC(ix,iy).write_rgb5a1_agb(blob_bmp);
-					}
-				}
-				break;
-			}
-			default: {
-				puts("aya::CPhoto::convert_rawAGI(fmt): error: format not supported ^^;");
-				std::exit(-1);
-				break;
-			}
+		const bool format_ok = alice_graphfmt::formats::visit(alice_graphfmt::getID(format),[&](auto traits) {
+			using Traits = decltype(traits);
+			aya::CPixelWriter writer(Traits::bpp,width(),height(),Traits::layout == pixfmt::Layout::Planar);
+			image_pack<Traits>(m_bmpdata.data(),width(),height(),writer);
+			blob_bmp = writer.blob_get();
+		});
+
+		if(!format_ok) {
+			puts("aya::CPhoto::convert_rawAGI(fmt): error: format not supported ^^;");
+			std::exit(-1);
 		}
-
 		return blob_bmp;
 	}
 	auto CPhoto::convert_rawHGI(int format) const -> scl::blob {
-		auto format_id = hourai_graphfmt::getID(format);
 		scl::blob blob_bmp;
-
-		switch(format_id) {
-			case hourai_graphfmt::i2: {
-				for(int iy=0; iy<height(); iy++) {
-					for(int ix=0; ix<width(); ix += 8) {
-						uint8_t plane0 = 0;
-						uint8_t plane1 = 0;
-						for(int o=0; o<8; o++) {
-							auto dot = dot_get(ix+o,iy).a & 3;
-							plane0 |= (dot&1) << (7-o);
-							plane1 |= (dot>>1) << (7-o);
-						}
-						
-						blob_bmp.write_u8(plane0);
-						blob_bmp.write_u8(plane1);
-					}
-				}		
-				break;
-			}
-			default: {
-				puts("aya::CPhoto::convert_rawHGI(): error: format not supported ^^;");
-				std::exit(-1);
-				break;
-			}
+		const bool format_ok = hourai_graphfmt::formats::visit(hourai_graphfmt::getID(format),[&](auto traits) {
+			using Traits = decltype(traits);
+			aya::CPixelWriter writer(Traits::bpp,width(),height(),Traits::layout == pixfmt::Layout::Planar);
+			image_pack<Traits>(m_bmpdata.data(),width(),height(),writer);
+			blob_bmp = writer.blob_get();
+		});
+
+		if(!format_ok) {
+			puts("aya::CPhoto::convert_rawHGI(fmt): error: format not supported ^^;");
+			std::exit(-1);
 		}
-
 		return blob_bmp;
 	}
 	auto CPhoto::convert_twiddled(int format) const -> scl::blob {
 		auto format_id = marisa_graphfmt::getID(format);
 		scl::blob blob_output;
-		scl::blob blob_curdot;
 
-		// bitmap writing fns ---------------------------@/
-		switch(format_id) {
-			case marisa_graphfmt::i4: {
-				//std::vector<uint8_t> bmpbuf(dimensions() / 2);
-				for(int iy=0; iy<height(); iy++) {
-					for(int ix=0; ix<width(); ix += 2) {
-						// ... don't even bother twiddling, i don't know what
-						// stupid ass format it's supposed to be in.
-						const uint32_t dotA = dot_getRawC(ix,iy).a & 0xF;
-						const uint32_t dotB = dot_getRawC(ix+1,iy).a & 0xF;
-						const uint32_t Tdot = dotA | (dotB<<4);
-						blob_output.write_u8(Tdot);
-					//	bmpbuf.push_back(Tdot);
-					}
-				}
-				//blob_output.write_raw(bmpbuf.data(),dimensions() / 2);
-				break;
-			}
-			case marisa_graphfmt::i8: {
-				std::vector<uint8_t> bmpbuf(dimensions());
-				for(int iy=0; iy<height(); iy++) {
-					for(int ix=0; ix<width(); ix++) {
-						const auto index = dot_getTwiddledIdx(ix,iy);
-						dot_getRawC(ix,iy).write_alpha(blob_curdot);
-						bmpbuf[index] = *blob_curdot.data<uint8_t*>();
-						blob_curdot.clear();
-					}
-				}
-				blob_output.write_raw(bmpbuf.data(),dimensions());
-				break;
-			}
-			case marisa_graphfmt::rgb565: {
-				std::vector<uint16_t> bmpbuf(dimensions());
+		if(width() != aya::conv_po2(width()) || height() != aya::conv_po2(height())) {
+			std::printf("aya::CPhoto::convert_twiddled(fmt): error: size (%d,%d) isn't a power of 2\n",
+				width(),height()
+			);
+			std::exit(-1);
+		}
+
+		const bool format_ok = marisa_graphfmt::formats::visit(format_id,[&](auto traits) {
+			using Traits = decltype(traits);
+			aya::CPixelWriter writer(Traits::bpp,width(),height());
+			std::vector<size_t> twid_row(width());
+
+			if constexpr(Traits::bpp == 4) {
+				// pvr 4bpp: texels go in twiddled order, two to a byte,
+				// the even one in the low nibble.
+				std::vector<uint8_t> pens(width());
+				uint8_t *bmp = writer.data();
 				for(int iy=0; iy<height(); iy++) {
+					aya::pack::row_i8(&dot_getRawC(0,iy),pens.data(),width());
+					aya::twiddled_rowIndices(iy,width(),height(),twid_row.data());
 					for(int ix=0; ix<width(); ix++) {
-						const auto index = dot_getTwiddledIdx(ix,iy);
-						dot_getRawC(ix,iy).write_rgb565(blob_curdot);
-						bmpbuf[index] = *blob_curdot.data<uint16_t*>();
-						blob_curdot.clear();
+						const size_t index = twid_row[ix];
+						bmp[index>>1] |= (pens[ix] & 0xF) << ((index&1) * 4);
 					}
 				}
-				blob_output.write_raw(bmpbuf.data(),dimensions() * sizeof(uint16_t));
-				break;
-			}
-			case marisa_graphfmt::rgb5a1: {
-				std::vector<uint16_t> bmpbuf(dimensions());
+			} else {
+				// convert a row at a time, then scatter each dot to its
+				// twiddled spot.
+				constexpr size_t dot_size = Traits::bpp / 8;
+				std::vector<uint8_t> rowbuf(writer.stride());
 				for(int iy=0; iy<height(); iy++) {
+					row_pack<Traits>(&dot_getRawC(0,iy),rowbuf.data(),width());
+					aya::twiddled_rowIndices(iy,width(),height(),twid_row.data());
 					for(int ix=0; ix<width(); ix++) {
-						const auto index = dot_getTwiddledIdx(ix,iy);
-						dot_getRawC(ix,iy).write_rgb5a1(blob_curdot);
-						bmpbuf[index] = *blob_curdot.data<uint16_t*>();
-						blob_curdot.clear();
+						std::memcpy(writer.data() + (twid_row[ix] * dot_size),rowbuf.data() + (ix * dot_size),dot_size);
 					}
 				}
-				blob_output.write_raw(bmpbuf.data(),dimensions() * sizeof(uint16_t));
-				break;
 			}
-			case marisa_graphfmt::argb4444: {
-				std::vector<uint16_t> bmpbuf(dimensions());
-				for(int iy=0; iy<height(); iy++) {
-					for(int ix=0; ix<width(); ix++) {
-						const auto index = dot_getTwiddledIdx(ix,iy);
-						dot_getRawC(ix,iy).write_argb4(blob_curdot);
-						bmpbuf[index] = *blob_curdot.data<uint16_t*>();
-						blob_curdot.clear();
-					}
-				}
-				blob_output.write_raw(bmpbuf.data(),dimensions() * sizeof(uint16_t));
-				break;
+			blob_output = writer.blob_get();
+		});
+
+		if(!format_ok) {
+			printf("imgconnv::CPhoto::twiddle(fmt): error: unsupported format (%d)\n",format_id);
+			std::exit(-1);
+		}
+		return blob_output;
+	}
+
+	auto CPhoto::convert_twiddledVQ(int format, bool preview) const -> scl::blob {
+		auto format_id = marisa_graphfmt::getID(format);
+		const int blocks_w = width() / 2;
+		const int blocks_h = height() / 2;
+
+		if(marisa_graphfmt::getBPP(format) != 16) {
+			std::printf("aya::CPhoto::convert_twiddledVQ(fmt): error: vq needs a 16-bit format (%d)\n",format_id);
+			std::exit(-1);
+		}
+		if(blocks_w == 0 || blocks_h == 0 || width() != aya::conv_po2(width()) || height() != aya::conv_po2(height())) {
+			std::printf("aya::CPhoto::convert_twiddledVQ(fmt): error: size (%d,%d) isn't a power of 2 of at least 2x2\n",
+				width(),height()
+			);
+			std::exit(-1);
+		}
+
+		// gather 2x2 blocks, in twiddled order ---------@/
+		std::vector<aya::CVQCodebook::block_t> blocks(size_t(blocks_w) * blocks_h);
+		std::vector<size_t> twid_row(blocks_w);
+		for(int by=0; by<blocks_h; by++) {
+			aya::twiddled_rowIndices(by,blocks_w,blocks_h,twid_row.data());
+			for(int bx=0; bx<blocks_w; bx++) {
+				auto& block = blocks[twid_row[bx]];
+				block[0] = dot_getRawC(bx*2,by*2);
+				block[1] = dot_getRawC(bx*2,by*2 + 1);
+				block[2] = dot_getRawC(bx*2 + 1,by*2);
+				block[3] = dot_getRawC(bx*2 + 1,by*2 + 1);
 			}
-			default: {
-				printf("imgconnv::CPhoto::twiddle(fmt): error: unsupported format (%d)\n",format_id);
-				std::exit(-1);
-				break;
+		}
+		// no sense spending entries on alpha that won't be kept
+		if(format_id == marisa_graphfmt::rgb565) {
+			for(auto& block : blocks) {
+				for(auto& dot : block) dot.a = 0xFF;
 			}
 		}
 
+		const aya::CVQCodebook codebook(blocks,
+			preview ? aya::CVQCodebook::ITERATIONS_PREVIEW : aya::CVQCodebook::ITERATIONS
+		);
+
+		// codebook, then indices -----------------------@/
+		scl::blob blob_output;
+		marisa_graphfmt::formats::visit(format_id,[&](auto traits) {
+			using Traits = decltype(traits);
+			if constexpr(Traits::bpp == 16) {
+				aya::CPixelWriter writer(Traits::bpp,4,aya::CVQCodebook::SIZE);
+				for(size_t e=0; e<aya::CVQCodebook::SIZE; e++) {
+					row_pack<Traits>(codebook.entry_get(e).data(),writer.row_get(e),4);
+				}
+				blob_output = writer.blob_get();
+			}
+		});
+		blob_output.write_raw(codebook.indices().data(),codebook.indices().size());
 		return blob_output;
 	}
 
-	auto CPhoto::convert_pngIndexed() -> scl::blob {
-		// create vector for lodepng --------------------@/
-		std::vector<unsigned char> dotbuffer(dimensions() * 4);
-		for(int i=0; i<dimensions(); i++) {
-			auto color = m_palette.at(m_bmpdata.at(i).a);
-			dotbuffer.at((i*4) + 0) = color.r;
-			dotbuffer.at((i*4) + 1) = color.g;
-			dotbuffer.at((i*4) + 2) = color.b;
-			dotbuffer.at((i*4) + 3) = 255;
-		//	dotbuffer.at((i*4) + 3) = color.a;
+	auto CPhoto::convert_twiddledMipmaps(int format) const -> scl::blob {
+		if(marisa_graphfmt::getBPP(format) != 16) {
+			std::printf("aya::CPhoto::convert_twiddledMipmaps(fmt): error: mipmaps need a 16-bit format (%d)\n",
+				marisa_graphfmt::getID(format)
+			);
+			std::exit(-1);
+		}
+		// the pvr only mipmaps square textures
+		if(width() != height() || width() != aya::conv_po2(width())) {
+			std::printf("aya::CPhoto::convert_twiddledMipmaps(fmt): error: size (%d,%d) isn't a square power of 2\n",
+				width(),height()
+			);
+			std::exit(-1);
 		}
 
-		//if there's an error, display it ---------------@/
-		std::vector<uint8_t> filebuffer;
-		unsigned error = lodepng::encode(filebuffer, dotbuffer, width(), height());
+		// full-size level first, then each one filtered from the last -@/
+		std::vector<scl::blob> levels;
+		levels.push_back(convert_twiddled(format));
 
-		if(error) {
-			std::printf("encoder error: %s\n",lodepng_error_text(error));
-			std::exit(-1);
+		int size = width();
+		std::vector<float> level_dots(m_bmpdata.size() * 4);
+		for(size_t i=0; i<m_bmpdata.size(); i++) {
+			dot_toLinear(m_bmpdata[i],&level_dots[i*4]);
 		}
+		std::vector<float> next_dots;
+		while(size > 1) {
+			level_halve(level_dots,size,next_dots);
+			size /= 2;
 
-		return scl::blob(filebuffer);
+			CPhoto level_pic(size,size);
+			for(size_t i=0; i<level_pic.m_bmpdata.size(); i++) {
+				level_pic.m_bmpdata[i] = dot_fromLinear(&next_dots[i*4]);
+			}
+			levels.push_back(level_pic.convert_twiddled(format));
+			level_dots.swap(next_dots);
+		}
+
+		// pvr order: padding, then smallest (1x1) to largest -----------@/
+		scl::blob blob_output;
+		for(int i=0; i<marisa_graphfmt::MIPMAP_PAD_16BPP; i++) {
+			blob_output.write_u8(0);
+		}
+		for(auto level = levels.rbegin(); level != levels.rend(); level++) {
+			blob_output.write_blob(*level);
+		}
+		return blob_output;
+	}
+
+	auto CPhoto::convert_pngIndexed() -> scl::blob {
+		std::vector<uint8_t> indices(dimensions());
+		for(int i=0; i<dimensions(); i++) {
+			indices[i] = m_bmpdata[i].a;
+		}
+		return scl::blob(aya::png_encodeIndexed(indices,width(),height(),m_palette));
 	};
 };
 
@@ -0,0 +1,166 @@
+#include <aya.h>
+#include <cstring>
+#include <filesystem>
+
+#if !defined(_WIN32)
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace {
+	constexpr uint32_t PHOTOCACHE_MAGIC = 0x43415941; // 'AYAC'
+	constexpr uint32_t PHOTOCACHE_VERSION = 1;
+
+	struct CPhotoCacheHeader {
+		uint32_t magic;
+		uint32_t version;
+		uint64_t src_hash;
+		uint64_t src_size;
+		int32_t width,height;
+		uint32_t paletted;
+		uint32_t reserved;
+		// then: palette (256 CColors), dots (width*height CColors)
+	};
+
+	// read-only view of a whole file. mmap'd where there's mmap, and
+	// just read into memory on windows.
+	class CMappedFile {
+		private:
+			const uint8_t *m_data;
+			size_t m_size;
+			void *m_map;
+			std::vector<uint8_t> m_buffer;
+
+		public:
+			auto is_open() const -> bool { return m_data != nullptr; }
+			auto data() const -> const uint8_t* { return m_data; }
+			auto size() const -> size_t { return m_size; }
+
+			CMappedFile(const std::string& filename) : m_data(nullptr),m_size(0),m_map(nullptr) {
+#if defined(_WIN32)
+				std::FILE *file = std::fopen(filename.c_str(),"rb");
+				if(!file) return;
+				std::fseek(file,0,SEEK_END);
+				const long file_size = std::ftell(file);
+				std::fseek(file,0,SEEK_SET);
+				if(file_size > 0) {
+					m_buffer.resize(file_size);
+					if(std::fread(m_buffer.data(),1,file_size,file) == size_t(file_size)) {
+						m_data = m_buffer.data();
+						m_size = file_size;
+					}
+				}
+				std::fclose(file);
+#else
+				const int fd = ::open(filename.c_str(),O_RDONLY);
+				if(fd < 0) return;
+				struct stat st;
+				if(::fstat(fd,&st) == 0 && st.st_size > 0) {
+					void *map = ::mmap(nullptr,st.st_size,PROT_READ,MAP_PRIVATE,fd,0);
+					if(map != MAP_FAILED) {
+						m_map = map;
+						m_data = static_cast<const uint8_t*>(map);
+						m_size = st.st_size;
+					}
+				}
+				::close(fd);
+#endif
+			}
+			CMappedFile(const CMappedFile&) = delete;
+			~CMappedFile() {
+#if !defined(_WIN32)
+				if(m_map) ::munmap(m_map,m_size);
+#endif
+			}
+	};
+};
+
+namespace aya {
+	auto CPhoto::file_loadCached(const std::string& filename, bool paletted, const std::string& cache_dir) -> CPhoto {
+		// hash source file -----------------------------@/
+		uint64_t src_hash = 0;
+		uint64_t src_size = 0;
+		{
+			CMappedFile src(filename);
+			if(!src.is_open()) return CPhoto(filename,paletted); // let it report the error
+			src_hash = aya::CTileDedupTable::key_hash(src.data(),src.size());
+			src_size = src.size();
+		}
+
+		char cache_name[64];
+		std::snprintf(cache_name,sizeof(cache_name),"%016llX_%c.ayc",
+			static_cast<unsigned long long>(src_hash), paletted ? 'p' : 'c'
+		);
+		const auto cache_path = std::filesystem::path(cache_dir) / cache_name;
+
+		// try cached copy ------------------------------@/
+		{
+			CMappedFile cached(cache_path.string());
+			CPhotoCacheHeader header;
+			if(cached.is_open() && cached.size() >= sizeof(header)) {
+				std::memcpy(&header,cached.data(),sizeof(header));
+				const size_t dots = size_t(header.width) * size_t(header.height);
+				const size_t expect_size = sizeof(header) + (256 + dots) * sizeof(aya::CColor);
+				const bool valid = header.magic == PHOTOCACHE_MAGIC
+					&& header.version == PHOTOCACHE_VERSION
+					&& header.src_hash == src_hash
+					&& header.src_size == src_size
+					&& header.paletted == uint32_t(paletted)
+					&& header.width > 0 && header.height > 0
+					&& cached.size() == expect_size;
+
+				if(valid) {
+					const uint8_t *data = cached.data() + sizeof(header);
+					CPhoto pic;
+					pic.m_width = header.width;
+					pic.m_height = header.height;
+					std::memcpy(pic.m_palette.data(),data,256 * sizeof(aya::CColor));
+					data += 256 * sizeof(aya::CColor);
+					pic.m_bmpdata.resize(dots);
+					std::memcpy(pic.m_bmpdata.data(),data,dots * sizeof(aya::CColor));
+					return pic;
+				}
+			}
+		}
+
+		// decode & write cache -------------------------@/
+		CPhoto pic(filename,paletted);
+
+		CPhotoCacheHeader header = {};
+		header.magic = PHOTOCACHE_MAGIC;
+		header.version = PHOTOCACHE_VERSION;
+		header.src_hash = src_hash;
+		header.src_size = src_size;
+		header.width = pic.width();
+		header.height = pic.height();
+		header.paletted = paletted;
+
+		// written to a temp file first, so a run that reads the cache
+		// alongside this one never sees a half-written file.
+		std::error_code fs_error;
+		std::filesystem::create_directories(cache_dir,fs_error);
+		auto temp_path = cache_path;
+		temp_path += ".tmp";
+
+		bool write_ok = false;
+		if(std::FILE *file = std::fopen(temp_path.string().c_str(),"wb")) {
+			write_ok = std::fwrite(&header,sizeof(header),1,file) == 1
+				&& std::fwrite(pic.m_palette.data(),sizeof(aya::CColor),256,file) == 256
+				&& std::fwrite(pic.m_bmpdata.data(),sizeof(aya::CColor),pic.m_bmpdata.size(),file) == pic.m_bmpdata.size();
+			write_ok = (std::fclose(file) == 0) && write_ok;
+		}
+		if(write_ok) {
+			std::filesystem::rename(temp_path,cache_path,fs_error);
+			write_ok = !fs_error;
+		}
+		if(!write_ok) {
+			std::filesystem::remove(temp_path,fs_error);
+			std::printf("aya::CPhoto::file_loadCached(): warning: unable to write cache file %s\n",
+				cache_path.string().c_str()
+			);
+		}
+		return pic;
+	}
+};
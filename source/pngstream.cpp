@@ -0,0 +1,349 @@
+#include <aya.h>
+#include <zlib.h>
+#include <cstring>
+#include <cstdlib>
+#include <algorithm>
+
+namespace {
+	constexpr size_t PNG_INPUT_SIZE = 0x10000;
+	constexpr uint8_t PNG_SIGNATURE[8] = { 0x89,'P','N','G',0x0D,0x0A,0x1A,0x0A };
+
+	auto read_be32(const uint8_t* src) -> uint32_t {
+		return (uint32_t(src[0])<<24) | (uint32_t(src[1])<<16)
+			| (uint32_t(src[2])<<8) | uint32_t(src[3]);
+	}
+	auto read_be16(const uint8_t* src) -> uint16_t {
+		return (uint16_t(src[0])<<8) | uint16_t(src[1]);
+	}
+	auto write_be32(std::vector<uint8_t>& out, uint32_t n) -> void {
+		out.push_back(n>>24); out.push_back(n>>16);
+		out.push_back(n>>8); out.push_back(n);
+	}
+	auto write_chunk(std::vector<uint8_t>& out, const char* type, const uint8_t* data, size_t size) -> void {
+		write_be32(out,size);
+		const size_t type_pos = out.size();
+		out.insert(out.end(),type,type + 4);
+		out.insert(out.end(),data,data + size);
+		write_be32(out,crc32(0,out.data() + type_pos,size + 4));
+	}
+	auto paeth(int a, int b, int c) -> uint8_t {
+		const int p = a + b - c;
+		const int pa = std::abs(p - a);
+		const int pb = std::abs(p - b);
+		const int pc = std::abs(p - c);
+		if(pa <= pb && pa <= pc) return a;
+		if(pb <= pc) return b;
+		return c;
+	}
+};
+
+auto aya::CPNGInfo::dot_bits() const -> int {
+	switch(colortype) {
+		case aya::PNGColorType::Gray: return bitdepth;
+		case aya::PNGColorType::RGB: return bitdepth * 3;
+		case aya::PNGColorType::Palette: return bitdepth;
+		case aya::PNGColorType::GrayAlpha: return bitdepth * 2;
+		case aya::PNGColorType::RGBA: return bitdepth * 4;
+	}
+	return 0;
+}
+
+struct aya::CPNGBandReader::CInflateState {
+	z_stream stream;
+	std::vector<uint8_t> input;
+
+	CInflateState() : stream(), input(PNG_INPUT_SIZE) {}
+};
+
+aya::CPNGBandReader::CPNGBandReader(const std::string& filename) {
+	m_file = nullptr;
+	m_filename = filename;
+	m_idatLeft = 0;
+	m_idatDone = false;
+	m_rowsRead = 0;
+
+	m_file = std::fopen(filename.c_str(),"rb");
+	if(!m_file) {
+		std::printf("aya::CPNGBandReader::CPNGBandReader(fname): error: unable to read file %s\n",
+			filename.c_str()
+		);
+		std::exit(-1);
+	}
+
+	uint8_t signature[8] = {};
+	if(std::fread(signature,1,8,m_file) != 8 || std::memcmp(signature,PNG_SIGNATURE,8) != 0) {
+		std::printf("aya::CPNGBandReader::CPNGBandReader(fname): error: %s is not a png\n",
+			filename.c_str()
+		);
+		std::exit(-1);
+	}
+
+	// read chunks up to the first IDAT -----------------@/
+	bool has_header = false;
+	uint8_t palette_alpha[256];
+	std::memset(palette_alpha,0xFF,sizeof(palette_alpha));
+
+	while(true) {
+		uint32_t length = 0;
+		std::array<char,4> type;
+		if(!chunk_readHeader(length,type)) {
+			std::printf("aya::CPNGBandReader::CPNGBandReader(fname): error: %s has no image data\n",
+				filename.c_str()
+			);
+			std::exit(-1);
+		}
+		const std::string type_str(type.data(),4);
+		if(type_str == "IDAT") {
+			m_idatLeft = length;
+			break;
+		}
+
+		std::vector<uint8_t> data(length + 4); // + crc
+		if(std::fread(data.data(),1,data.size(),m_file) != data.size()) {
+			std::printf("aya::CPNGBandReader::CPNGBandReader(fname): error: %s is truncated\n",
+				filename.c_str()
+			);
+			std::exit(-1);
+		}
+
+		if(type_str == "IHDR" && length >= 13) {
+			m_info.width = read_be32(&data[0]);
+			m_info.height = read_be32(&data[4]);
+			m_info.bitdepth = data[8];
+			m_info.colortype = data[9];
+			m_info.interlaced = data[12] != 0;
+			has_header = true;
+		} else if(type_str == "PLTE") {
+			m_info.palettesize = std::min<int>(length / 3,256);
+			for(int i=0; i<m_info.palettesize; i++) {
+				m_info.palette[i] = aya::CColor(0xFF,data[i*3 + 0],data[i*3 + 1],data[i*3 + 2]);
+			}
+		} else if(type_str == "tRNS") {
+			if(m_info.colortype == aya::PNGColorType::Palette) {
+				for(int i=0; i<std::min<int>(length,256); i++) {
+					palette_alpha[i] = data[i];
+				}
+			} else if(m_info.colortype == aya::PNGColorType::Gray && length >= 2) {
+				m_info.key_defined = true;
+				m_info.key_r = m_info.key_g = m_info.key_b = read_be16(&data[0]);
+			} else if(m_info.colortype == aya::PNGColorType::RGB && length >= 6) {
+				m_info.key_defined = true;
+				m_info.key_r = read_be16(&data[0]);
+				m_info.key_g = read_be16(&data[2]);
+				m_info.key_b = read_be16(&data[4]);
+			}
+		} else if(type_str == "IEND") {
+			break;
+		}
+	}
+
+	if(!has_header || m_info.dot_bits() == 0) {
+		std::printf("aya::CPNGBandReader::CPNGBandReader(fname): error: %s has a bad header\n",
+			filename.c_str()
+		);
+		std::exit(-1);
+	}
+	for(int i=0; i<m_info.palettesize; i++) {
+		m_info.palette[i].a = palette_alpha[i];
+	}
+
+	// start inflating ----------------------------------@/
+	m_inflate = std::make_unique<CInflateState>();
+	if(inflateInit(&m_inflate->stream) != Z_OK) {
+		std::printf("aya::CPNGBandReader::CPNGBandReader(fname): error: inflateInit failed\n");
+		std::exit(-1);
+	}
+	m_rowPrev = std::vector<uint8_t>(m_info.row_stride() + 1);
+	m_rowCur = std::vector<uint8_t>(m_info.row_stride() + 1);
+}
+aya::CPNGBandReader::~CPNGBandReader() {
+	if(m_inflate) inflateEnd(&m_inflate->stream);
+	if(m_file) std::fclose(m_file);
+}
+
+auto aya::CPNGBandReader::chunk_readHeader(uint32_t& length, std::array<char,4>& type) -> bool {
+	uint8_t header[8];
+	if(std::fread(header,1,8,m_file) != 8) return false;
+	length = read_be32(header);
+	std::memcpy(type.data(),header + 4,4);
+	return true;
+}
+auto aya::CPNGBandReader::input_refill() -> bool {
+	// move on to the next IDAT once this one's used up --@/
+	while(m_idatLeft == 0) {
+		if(m_idatDone) return false;
+
+		uint32_t length = 0;
+		std::array<char,4> type;
+		std::fseek(m_file,4,SEEK_CUR); // skip previous crc
+		if(!chunk_readHeader(length,type) || std::memcmp(type.data(),"IDAT",4) != 0) {
+			m_idatDone = true;
+			return false;
+		}
+		m_idatLeft = length;
+	}
+
+	auto& input = m_inflate->input;
+	const size_t read_size = std::min<size_t>(m_idatLeft,input.size());
+	if(std::fread(input.data(),1,read_size,m_file) != read_size) {
+		std::printf("aya::CPNGBandReader::input_refill(): error: %s is truncated\n",
+			m_filename.c_str()
+		);
+		std::exit(-1);
+	}
+	m_idatLeft -= read_size;
+	m_inflate->stream.next_in = input.data();
+	m_inflate->stream.avail_in = read_size;
+	return true;
+}
+auto aya::CPNGBandReader::row_inflate(uint8_t* out, size_t size) -> void {
+	auto& stream = m_inflate->stream;
+	stream.next_out = out;
+	stream.avail_out = size;
+
+	while(stream.avail_out > 0) {
+		if(stream.avail_in == 0 && !input_refill()) {
+			std::printf("aya::CPNGBandReader::row_inflate(): error: %s has too little image data\n",
+				m_filename.c_str()
+			);
+			std::exit(-1);
+		}
+		const int ret = inflate(&stream,Z_NO_FLUSH);
+		if(ret == Z_STREAM_END && stream.avail_out > 0) {
+			std::printf("aya::CPNGBandReader::row_inflate(): error: %s has too little image data\n",
+				m_filename.c_str()
+			);
+			std::exit(-1);
+		}
+		if(ret != Z_OK && ret != Z_STREAM_END && ret != Z_BUF_ERROR) {
+			std::printf("aya::CPNGBandReader::row_inflate(): error: %s has bad image data (zlib %d)\n",
+				m_filename.c_str(),ret
+			);
+			std::exit(-1);
+		}
+	}
+}
+auto aya::CPNGBandReader::row_unfilter() -> void {
+	const size_t stride = m_rowCur.size() - 1;
+	const size_t bpp = std::max(1,m_info.dot_bits() / 8);
+	uint8_t *cur = m_rowCur.data() + 1;
+	const uint8_t *prev = m_rowPrev.data() + 1;
+
+	switch(m_rowCur[0]) {
+		case 0: break;
+		case 1: {
+			for(size_t i=bpp; i<stride; i++) cur[i] += cur[i - bpp];
+			break;
+		}
+		case 2: {
+			for(size_t i=0; i<stride; i++) cur[i] += prev[i];
+			break;
+		}
+		case 3: {
+			for(size_t i=0; i<bpp; i++) cur[i] += prev[i] / 2;
+			for(size_t i=bpp; i<stride; i++) cur[i] += (cur[i - bpp] + prev[i]) / 2;
+			break;
+		}
+		case 4: {
+			for(size_t i=0; i<bpp; i++) cur[i] += prev[i];
+			for(size_t i=bpp; i<stride; i++) {
+				cur[i] += paeth(cur[i - bpp],prev[i],prev[i - bpp]);
+			}
+			break;
+		}
+		default: {
+			std::printf("aya::CPNGBandReader::row_unfilter(): error: %s has bad filter type %d\n",
+				m_filename.c_str(),m_rowCur[0]
+			);
+			std::exit(-1);
+		}
+	}
+}
+
+auto aya::CPNGBandReader::band_read(std::vector<uint8_t>& band, int max_rows) -> int {
+	if(!is_streamable()) {
+		std::printf("aya::CPNGBandReader::band_read(): error: %s is interlaced\n",
+			m_filename.c_str()
+		);
+		std::exit(-1);
+	}
+
+	const size_t stride = m_info.row_stride();
+	const int rows = std::min(max_rows,rows_left());
+	band.resize(stride * rows);
+
+	for(int iy=0; iy<rows; iy++) {
+		row_inflate(m_rowCur.data(),m_rowCur.size());
+		row_unfilter();
+		std::memcpy(band.data() + (iy * stride),m_rowCur.data() + 1,stride);
+		std::swap(m_rowCur,m_rowPrev);
+	}
+	m_rowsRead += rows;
+	return rows;
+}
+
+auto aya::png_encodeIndexed(const std::vector<uint8_t>& indices, int width, int height,
+	const std::array<aya::CColor,256>& palette
+) -> std::vector<uint8_t> {
+	/*
+	 * writes a palette png meant for quick previews, not for size: every
+	 * row uses filter 0 (which is what palette images usually want
+	 * anyway), and deflate runs at its fastest level. 4bpp is used when
+	 * every index fits in a nibble.
+	*/
+	const size_t dots = size_t(width) * height;
+	if(width <= 0 || height <= 0 || indices.size() < dots) {
+		std::printf("aya::png_encodeIndexed(): error: bad dimensions (%d,%d)\n",width,height);
+		std::exit(-1);
+	}
+
+	int max_index = 0;
+	for(size_t i=0; i<dots; i++) {
+		max_index = std::max<int>(max_index,indices[i]);
+	}
+	const int bitdepth = max_index < 16 ? 4 : 8;
+	const size_t stride = (size_t(width) * bitdepth + 7) / 8;
+
+	// pack scanlines ---------------------------------------@/
+	std::vector<uint8_t> scanlines((stride + 1) * height);
+	for(int iy=0; iy<height; iy++) {
+		uint8_t *row = scanlines.data() + (iy * (stride + 1));
+		const uint8_t *src = indices.data() + (size_t(iy) * width);
+		row[0] = 0; // filter: none
+		if(bitdepth == 8) {
+			std::memcpy(row + 1,src,width);
+		} else {
+			for(int ix=0; ix<width; ix += 2) {
+				const uint8_t lo = (ix+1 < width) ? src[ix+1] : 0;
+				row[1 + ix/2] = (src[ix] << 4) | lo;
+			}
+		}
+	}
+
+	uLongf zsize = compressBound(scanlines.size());
+	std::vector<uint8_t> zdata(zsize);
+	if(compress2(zdata.data(),&zsize,scanlines.data(),scanlines.size(),Z_BEST_SPEED) != Z_OK) {
+		std::printf("aya::png_encodeIndexed(): error: deflate failed\n");
+		std::exit(-1);
+	}
+
+	// write chunks -----------------------------------------@/
+	std::vector<uint8_t> out(PNG_SIGNATURE,PNG_SIGNATURE + 8);
+	out.reserve(8 + 25 + (12 + 768) + (12 + zsize) + 12);
+
+	std::vector<uint8_t> ihdr;
+	write_be32(ihdr,width);
+	write_be32(ihdr,height);
+	ihdr.insert(ihdr.end(),{ uint8_t(bitdepth),aya::PNGColorType::Palette,0,0,0 });
+	write_chunk(out,"IHDR",ihdr.data(),ihdr.size());
+
+	std::vector<uint8_t> plte;
+	for(int i=0; i<=max_index; i++) {
+		plte.insert(plte.end(),{ palette[i].r,palette[i].g,palette[i].b });
+	}
+	write_chunk(out,"PLTE",plte.data(),plte.size());
+
+	write_chunk(out,"IDAT",zdata.data(),zsize);
+	write_chunk(out,"IEND",nullptr,0);
+	return out;
+}
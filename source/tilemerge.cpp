@@ -0,0 +1,476 @@
+#include <aya.h>
+#include <algorithm>
+#include <numeric>
+#include <queue>
+#include <cmath>
+#include <limits>
+
+namespace {
+	// a tile's dots as flat argb floats, looked up through the palette
+	// for indexed tiles, so "close" means close in color, not in pen number.
+	// indexed tiles are looked up in their own <bank> of 2^bpp colors.
+	using tilevec_t = std::vector<float>;
+
+	// searches are done on a small signature of each tile first (the
+	// mean color of each of its 2x2 blocks), and only the closest few
+	// matches are then compared dot by dot.
+	constexpr int SIG_BLOCKS = 2;
+	constexpr int SIG_DIMS = SIG_BLOCKS * SIG_BLOCKS * 4;
+	constexpr size_t SIG_MATCHES = 48;   // signature matches (per flip) compared exactly
+	constexpr size_t REFIND_BATCH = 256; // groups looked up again at once, on all threads
+	// searches skip branches that can't hold anything nearer than this
+	// much of the furthest match so far. it's not exact, but tile
+	// signatures spread out too much for a tree to prune exactly.
+	constexpr float SEARCH_SLACK = 0.5f;
+	using sig_t = std::array<float,SIG_DIMS>;
+
+	auto tile_toVector(const aya::CPhoto& tile, int bpp, const std::array<aya::CColor,256>& palette, int bank, int flip) -> tilevec_t {
+		tilevec_t vec;
+		vec.reserve(size_t(tile.width()) * tile.height() * 4);
+		const bool flip_x = flip & 1;
+		const bool flip_y = (flip >> 1) & 1;
+		const int bank_size = (bpp <= 8) ? (1<<bpp) : 0;
+		for(int y=0; y<tile.height(); y++) {
+			const int fy = flip_y ? (tile.height()-y-1) : y;
+			for(int x=0; x<tile.width(); x++) {
+				const int fx = flip_x ? (tile.width()-x-1) : x;
+				const auto dot = tile.dot_get(fx,fy);
+				const auto color = (bpp <= 8) ? palette[((bank * bank_size) + (dot.a & (bank_size-1))) & 0xFF] : dot;
+				vec.push_back(color.a);
+				vec.push_back(color.r);
+				vec.push_back(color.g);
+				vec.push_back(color.b);
+			}
+		}
+		return vec;
+	}
+	auto vector_distance2(const tilevec_t& vec_a, const tilevec_t& vec_b) -> float {
+		float dist = 0;
+		for(size_t i=0; i<vec_a.size(); i++) {
+			const float diff = vec_a[i] - vec_b[i];
+			dist += diff * diff;
+		}
+		return dist;
+	}
+
+	// each block's mean, scaled by the square root of its dot count, so
+	// the distance between two signatures is never more than the distance
+	// between their tiles.
+	auto vector_toSig(const tilevec_t& vec, int width, int height) -> sig_t {
+		sig_t sig = {};
+		std::array<int,SIG_BLOCKS*SIG_BLOCKS> counts = {};
+		for(int y=0; y<height; y++) {
+			for(int x=0; x<width; x++) {
+				const int block = ((y * SIG_BLOCKS / height) * SIG_BLOCKS) + (x * SIG_BLOCKS / width);
+				for(int c=0; c<4; c++) sig[(block*4) + c] += vec[(((y*width) + x) * 4) + c];
+				counts[block]++;
+			}
+		}
+		for(int block=0; block<SIG_BLOCKS*SIG_BLOCKS; block++) {
+			if(counts[block] == 0) continue;
+			for(int c=0; c<4; c++) sig[(block*4) + c] /= std::sqrt(float(counts[block]));
+		}
+		return sig;
+	}
+	auto sig_distance(const sig_t& sig_a, const sig_t& sig_b) -> float {
+		float dist = 0;
+		for(int i=0; i<SIG_DIMS; i++) {
+			const float diff = sig_a[i] - sig_b[i];
+			dist += diff * diff;
+		}
+		return std::sqrt(dist);
+	}
+
+	// vantage-point tree over signatures, for k-nearest lookups. points
+	// are never taken out; dead ones are only skipped when searching, and
+	// the tree's rebuilt once too many of them have died.
+	class CVPTree {
+		private:
+			struct CNode {
+				uint32_t point;
+				float radius;
+				int inside,outside; // node indices, -1 if none
+			};
+			const std::vector<sig_t>& m_points;
+			std::vector<CNode> m_nodes;
+			int m_root;
+			size_t m_numBuilt;
+
+			auto node_build(std::vector<uint32_t>& items, size_t begin, size_t end) -> int {
+				if(begin >= end) return -1;
+				const int node_idx = m_nodes.size();
+				m_nodes.push_back({ items[begin],0.0f,-1,-1 });
+				if(end - begin == 1) return node_idx;
+
+				const auto& vantage = m_points[items[begin]];
+				std::vector<std::pair<float,uint32_t>> dists;
+				dists.reserve(end - begin - 1);
+				for(size_t i=begin+1; i<end; i++) {
+					dists.push_back({ sig_distance(vantage,m_points[items[i]]),items[i] });
+				}
+				const size_t mid = dists.size() / 2;
+				std::nth_element(dists.begin(),dists.begin() + mid,dists.end());
+				for(size_t i=0; i<dists.size(); i++) {
+					items[begin + 1 + i] = dists[i].second;
+				}
+
+				const float radius = dists[mid].first;
+				const int inside = node_build(items,begin + 1,begin + 1 + mid);
+				const int outside = node_build(items,begin + 1 + mid,end);
+				m_nodes[node_idx].radius = radius;
+				m_nodes[node_idx].inside = inside;
+				m_nodes[node_idx].outside = outside;
+				return node_idx;
+			}
+
+			// <found> is a max-heap of (distance,point), at most <count> big
+			template<typename Usable> auto node_search(int node_idx, const sig_t& query, size_t count,
+				const Usable& usable, std::vector<std::pair<float,uint32_t>>& found
+			) const -> void {
+				if(node_idx < 0) return;
+				const auto& node = m_nodes[node_idx];
+				const float dist = sig_distance(query,m_points[node.point]);
+				if(usable(node.point)) {
+					const std::pair<float,uint32_t> item = { dist,node.point };
+					if(found.size() < count) {
+						found.push_back(item);
+						std::push_heap(found.begin(),found.end());
+					} else if(item < found.front()) {
+						std::pop_heap(found.begin(),found.end());
+						found.back() = item;
+						std::push_heap(found.begin(),found.end());
+					}
+				}
+				auto reach = [&]() {
+					return (found.size() < count) ? std::numeric_limits<float>::max() : (found.front().first * SEARCH_SLACK);
+				};
+				if(dist < node.radius) {
+					node_search(node.inside,query,count,usable,found);
+					if(dist + reach() >= node.radius) node_search(node.outside,query,count,usable,found);
+				} else {
+					node_search(node.outside,query,count,usable,found);
+					if(dist - reach() <= node.radius) node_search(node.inside,query,count,usable,found);
+				}
+			}
+
+		public:
+			auto built_size() const -> size_t { return m_numBuilt; }
+
+			template<typename Usable> auto build(const Usable& usable) -> void {
+				std::vector<uint32_t> items;
+				for(size_t i=0; i<m_points.size(); i++) {
+					if(usable(i)) items.push_back(i);
+				}
+				m_nodes.clear();
+				m_nodes.reserve(items.size());
+				m_root = node_build(items,0,items.size());
+				m_numBuilt = items.size();
+			}
+			// the <count> points nearest to <query> that <usable> allows,
+			// nearest first. ties go to the lowest index.
+			template<typename Usable> auto search(const sig_t& query, size_t count, const Usable& usable) const
+				-> std::vector<std::pair<float,uint32_t>>
+			{
+				std::vector<std::pair<float,uint32_t>> found;
+				found.reserve(count + 1);
+				node_search(m_root,query,count,usable,found);
+				std::sort_heap(found.begin(),found.end());
+				return found;
+			}
+
+			CVPTree(const std::vector<sig_t>& points) : m_points(points),m_root(-1),m_numBuilt(0) {}
+	};
+
+	struct CNeighbor {
+		float dist2;
+		uint32_t group;
+		int flip;
+	};
+
+	struct CMergeCandidate {
+		double cost;
+		size_t group;
+		size_t target;
+		int flip;
+		size_t weight; // group's weight when this was found
+		bool refind;   // ran out of neighbors; cost is only a guess
+
+		auto operator>(const CMergeCandidate& other) const -> bool {
+			if(cost != other.cost) return cost > other.cost;
+			return group > other.group;
+		}
+	};
+};
+
+aya::CTileMerger::CTileMerger(std::vector<std::shared_ptr<aya::CPhoto>>& tiles, int bpp, int num_flips, size_t budget,
+	const std::array<aya::CColor,256>& palette, const std::vector<int>& tile_banks
+) : m_merges(),m_totalError(0),m_numUnique(0),m_numValues(0)
+{
+	if(tiles.empty()) return;
+	const int tile_w = tiles[0]->width();
+	const int tile_h = tiles[0]->height();
+	const size_t tile_dots = size_t(tile_w) * tile_h;
+	m_numValues = tiles.size() * tile_dots * 4;
+	auto bank_get = [&](size_t tile) { return tile_banks.empty() ? 0 : tile_banks[tile]; };
+
+	// group exact duplicates, like the converters do ---@/
+	// tile i == flip(group's first tile, tile_flip[i])
+	const aya::CTileKeyList tile_keys(tiles,bpp,num_flips);
+	aya::CTileDedupTable key_table(tile_keys.key_size(),tiles.size());
+	std::vector<size_t> group_tile; // first tile of each group
+	std::vector<size_t> tile_group(tiles.size());
+	std::vector<int> tile_flip(tiles.size(),0);
+	std::vector<size_t> group_weight;
+
+	for(size_t i=0; i<tiles.size(); i++) {
+		bool found = false;
+		for(int fi=0; fi<num_flips && !found; fi++) {
+			const auto group = key_table.find(tile_keys.key_get(i,fi),tile_keys.hash_get(i,fi));
+			if(group.has_value()) {
+				tile_group[i] = group.value();
+				tile_flip[i] = fi;
+				group_weight[group.value()]++;
+				found = true;
+			}
+		}
+		if(!found) {
+			key_table.insert(tile_keys.key_get(i,0),tile_keys.hash_get(i,0),group_tile.size());
+			tile_group[i] = group_tile.size();
+			group_tile.push_back(i);
+			group_weight.push_back(1);
+		}
+	}
+	m_numUnique = group_tile.size();
+	if(m_numUnique <= budget) return;
+
+	// vectors & signatures (on all threads) ------------@/
+	// point (g*num_flips + f) is group g flipped by f.
+	const size_t num_groups = group_tile.size();
+	const bool is_indexed = bpp <= 8;
+	const int bank_size = is_indexed ? (1<<bpp) : 0;
+	std::vector<tilevec_t> group_vecs(num_groups);
+	std::vector<std::vector<uint8_t>> group_pens(is_indexed ? num_groups : 0);
+	std::vector<sig_t> point_sigs(num_groups * num_flips);
+	aya::util::parallel_for(num_groups,[&](size_t begin, size_t end) {
+		for(size_t g=begin; g<end; g++) {
+			const auto& tile = *tiles[group_tile[g]];
+			const int bank = bank_get(group_tile[g]);
+			for(int fi=0; fi<num_flips; fi++) {
+				auto vec = tile_toVector(tile,bpp,palette,bank,fi);
+				point_sigs[(g*num_flips) + fi] = vector_toSig(vec,tile_w,tile_h);
+				if(fi == 0) group_vecs[g] = std::move(vec);
+			}
+			if(is_indexed) {
+				auto& pens = group_pens[g];
+				pens.reserve(tile_dots);
+				for(int y=0; y<tile_h; y++) {
+					for(int x=0; x<tile_w; x++) pens.push_back(tile.dot_get(x,y).a & (bank_size-1));
+				}
+			}
+		}
+	});
+
+	// where each dot of a flipped tile comes from
+	std::vector<std::vector<uint32_t>> flip_dots(num_flips);
+	for(int fi=0; fi<num_flips; fi++) {
+		for(int y=0; y<tile_h; y++) {
+			const int fy = (fi & 2) ? (tile_h-y-1) : y;
+			for(int x=0; x<tile_w; x++) {
+				const int fx = (fi & 1) ? (tile_w-x-1) : x;
+				flip_dots[fi].push_back((fy * tile_w) + fx);
+			}
+		}
+	}
+
+	// error for <group>'s tiles to use <target> flipped by <flip>. with
+	// banks, they'd show the target's pens in their own bank.
+	auto group_distance2 = [&](size_t group, size_t target, int flip) -> float {
+		const auto& vec = group_vecs[group];
+		const auto& dots = flip_dots[flip];
+		float dist = 0;
+		if(is_indexed) {
+			const auto& pens = group_pens[target];
+			const int bank_base = bank_get(group_tile[group]) * bank_size;
+			for(size_t d=0; d<tile_dots; d++) {
+				const auto& color = palette[(bank_base + pens[dots[d]]) & 0xFF];
+				const float diff_a = vec[(d*4) + 0] - color.a;
+				const float diff_r = vec[(d*4) + 1] - color.r;
+				const float diff_g = vec[(d*4) + 2] - color.g;
+				const float diff_b = vec[(d*4) + 3] - color.b;
+				dist += (diff_a*diff_a) + (diff_r*diff_r) + (diff_g*diff_g) + (diff_b*diff_b);
+			}
+		} else {
+			const auto& target_vec = group_vecs[target];
+			for(size_t d=0; d<tile_dots; d++) {
+				for(int c=0; c<4; c++) {
+					const float diff = vec[(d*4) + c] - target_vec[(dots[d]*4) + c];
+					dist += diff * diff;
+				}
+			}
+		}
+		return dist;
+	};
+
+	// greedy merging -----------------------------------@/
+	// always merge the group that's cheapest to lose (its distance to the
+	// nearest other group, times how many tiles use it). each group keeps
+	// a list of its nearest groups; when the one in front dies, the next
+	// one's used, and the list's only looked up again once it runs out.
+	std::vector<bool> alive(num_groups,true);
+	std::vector<size_t> parent(num_groups);
+	std::vector<int> parent_flip(num_groups,0);
+	std::iota(parent.begin(),parent.end(),0);
+	size_t num_alive = num_groups;
+
+	CVPTree tree(point_sigs);
+	auto point_alive = [&](size_t point) { return bool(alive[point / num_flips]); };
+	tree.build(point_alive);
+
+	std::vector<std::vector<CNeighbor>> neighbors(num_groups);
+	std::vector<size_t> neighbor_next(num_groups,0);
+	auto neighbors_find = [&](size_t group) {
+		const auto found = tree.search(point_sigs[group*num_flips],SIG_MATCHES * num_flips,[&](size_t point) {
+			const size_t target = point / num_flips;
+			return (target != group) && alive[target];
+		});
+		// the signature of group flipped by f matches target, so
+		// flip_f(target) ~= group; keep each target's best flip.
+		auto& list = neighbors[group];
+		list.clear();
+		for(const auto& match : found) {
+			const uint32_t target = match.second / num_flips;
+			const int flip = match.second % num_flips;
+			const float dist2 = group_distance2(group,target,flip);
+			auto prev = std::find_if(list.begin(),list.end(),[&](const CNeighbor& n) { return n.group == target; });
+			if(prev == list.end()) list.push_back({ dist2,target,flip });
+			else if(dist2 < prev->dist2) *prev = { dist2,target,flip };
+		}
+		std::sort(list.begin(),list.end(),[](const CNeighbor& a, const CNeighbor& b) {
+			if(a.dist2 != b.dist2) return a.dist2 < b.dist2;
+			return a.group < b.group;
+		});
+		neighbor_next[group] = 0;
+	};
+	auto candidate_next = [&](size_t group) -> CMergeCandidate {
+		const auto& list = neighbors[group];
+		size_t& next = neighbor_next[group];
+		while(next < list.size() && !alive[list[next].group]) next++;
+		if(next < list.size()) {
+			const auto& n = list[next];
+			return { double(n.dist2) * group_weight[group],group,n.group,n.flip,group_weight[group],false };
+		}
+		// everything it knew of is gone; anything else is further off
+		const double guess = list.empty() ? 0.0 : double(list.back().dist2);
+		return { guess * group_weight[group],group,group,0,group_weight[group],true };
+	};
+
+	std::priority_queue<CMergeCandidate,std::vector<CMergeCandidate>,std::greater<CMergeCandidate>> queue;
+	aya::util::parallel_for(num_groups,[&](size_t begin, size_t end) {
+		for(size_t g=begin; g<end; g++) neighbors_find(g);
+	});
+	for(size_t g=0; g<num_groups; g++) {
+		const auto candidate = candidate_next(g);
+		if(!candidate.refind) queue.push(candidate);
+	}
+
+	while(num_alive > budget && !queue.empty()) {
+		const auto candidate = queue.top();
+		queue.pop();
+		if(!alive[candidate.group]) continue;
+
+		// look up groups that ran out, a batch at a time
+		if(candidate.refind) {
+			std::vector<size_t> batch = { candidate.group };
+			while(!queue.empty() && queue.top().refind && batch.size() < REFIND_BATCH) {
+				if(alive[queue.top().group]) batch.push_back(queue.top().group);
+				queue.pop();
+			}
+			if(num_alive * 2 < tree.built_size()) tree.build(point_alive);
+			aya::util::parallel_for(batch.size(),[&](size_t begin, size_t end) {
+				for(size_t i=begin; i<end; i++) neighbors_find(batch[i]);
+			});
+			for(auto group : batch) {
+				const auto refound = candidate_next(group);
+				if(!refound.refind) queue.push(refound);
+			}
+			continue;
+		}
+		if(!alive[candidate.target] || candidate.weight != group_weight[candidate.group]) {
+			queue.push(candidate_next(candidate.group));
+			continue;
+		}
+
+		// flip_f(target) ~= group, so group ~= flip_f(target)
+		alive[candidate.group] = false;
+		parent[candidate.group] = candidate.target;
+		parent_flip[candidate.group] = candidate.flip;
+		group_weight[candidate.target] += group_weight[candidate.group];
+		num_alive--;
+	}
+
+	// point every tile at its group's final stand-in -----@/
+	// flips only ever mirror, so following a chain just xors them.
+	std::vector<size_t> group_root(num_groups);
+	std::vector<int> group_rootFlip(num_groups);
+	for(size_t g=0; g<num_groups; g++) {
+		size_t root = g;
+		int flip = 0;
+		while(parent[root] != root) {
+			flip ^= parent_flip[root];
+			root = parent[root];
+		}
+		group_root[g] = root;
+		group_rootFlip[g] = flip;
+	}
+
+	// tiles keep their own bank, so that's what they're measured in
+	std::vector<double> group_error(num_groups,0.0);
+	for(size_t i=0; i<tiles.size(); i++) {
+		const size_t g = tile_group[i];
+		if(group_root[g] == g) continue;
+
+		const auto& root_tile = tiles[group_tile[group_root[g]]];
+		const int flip = tile_flip[i] ^ group_rootFlip[g];
+		auto new_tile = root_tile->img_flip(flip);
+		group_error[g] += vector_distance2(
+			tile_toVector(*tiles[i],bpp,palette,bank_get(i),0),
+			tile_toVector(*new_tile,bpp,palette,bank_get(i),0)
+		);
+		tiles[i] = new_tile;
+	}
+
+	for(size_t g=0; g<num_groups; g++) {
+		if(group_root[g] == g) continue;
+		m_merges.push_back({ group_tile[g],group_tile[group_root[g]],group_rootFlip[g],group_error[g] });
+		m_totalError += group_error[g];
+	}
+}
+
+auto aya::CTileMerger::report_print(int tiles_perRow, int tile_w, int tile_h, bool verbose) const -> void {
+	if(m_merges.empty()) return;
+
+	std::printf("aya: warning: merged %zu of %zu unique cels to fit (total error %.0f, rms %.2f per channel)\n",
+		m_merges.size(),m_numUnique,m_totalError,std::sqrt(m_totalError / m_numValues)
+	);
+	if(!verbose) return;
+
+	auto tile_getXY = [&](size_t idx, int& x, int& y) {
+		x = tile_w * (idx % tiles_perRow);
+		y = tile_h * (idx / tiles_perRow);
+	};
+	for(const auto& merge : m_merges) {
+		if(tiles_perRow <= 0) {
+			std::printf("merged tile %4zu -> tile %4zu [fi=%d] error %.0f\n",
+				merge.tile,merge.into,merge.flip,merge.error
+			);
+			continue;
+		}
+		int src_x,src_y;
+		int dst_x,dst_y;
+		tile_getXY(merge.tile,src_x,src_y);
+		tile_getXY(merge.into,dst_x,dst_y);
+		std::printf("merged (%3d,%3d) -> (%3d,%3d) [fi=%d] error %.0f\n",
+			src_x,src_y,dst_x,dst_y,merge.flip,merge.error
+		);
+	}
+}
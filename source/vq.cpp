@@ -0,0 +1,201 @@
+#include <aya.h>
+#include <algorithm>
+#include <numeric>
+#include <cmath>
+#include <limits>
+
+/*
+ * k-means for pvr vq codebooks. identical blocks are merged (with a weight)
+ * first, since most textures repeat plenty of them. each pass then finds
+ * every block's nearest entry across all threads, and moves each entry to
+ * the mean of its blocks. the sums are done on one thread in block order,
+ * so the output never depends on how many threads ran.
+*/
+
+namespace {
+	constexpr int VQ_DIMS = 16; // 4 dots, argb each
+
+	using block_t = aya::CVQCodebook::block_t;
+	using vector_t = std::array<float,VQ_DIMS>;
+
+	auto block_less(const block_t& block_a, const block_t& block_b) -> bool {
+		for(int i=0; i<4; i++) {
+			if(block_a[i].rawdata() != block_b[i].rawdata()) {
+				return block_a[i].rawdata() < block_b[i].rawdata();
+			}
+		}
+		return false;
+	}
+	auto block_equals(const block_t& block_a, const block_t& block_b) -> bool {
+		for(int i=0; i<4; i++) {
+			if(block_a[i].rawdata() != block_b[i].rawdata()) return false;
+		}
+		return true;
+	}
+
+	auto block_toVector(const block_t& block) -> vector_t {
+		vector_t vec;
+		for(int i=0; i<4; i++) {
+			vec[(i*4) + 0] = block[i].a;
+			vec[(i*4) + 1] = block[i].r;
+			vec[(i*4) + 2] = block[i].g;
+			vec[(i*4) + 3] = block[i].b;
+		}
+		return vec;
+	}
+	auto vector_toBlock(const vector_t& vec) -> block_t {
+		auto channel = [&](int i) -> uint8_t {
+			return std::clamp<int>(std::lround(vec[i]),0,255);
+		};
+		block_t block;
+		for(int i=0; i<4; i++) {
+			block[i] = aya::CColor(channel((i*4) + 0),channel((i*4) + 1),channel((i*4) + 2),channel((i*4) + 3));
+		}
+		return block;
+	}
+
+	auto vector_distance(const vector_t& vec_a, const vector_t& vec_b) -> float {
+		float dist = 0;
+		for(int i=0; i<VQ_DIMS; i++) {
+			const float diff = vec_a[i] - vec_b[i];
+			dist += diff * diff;
+		}
+		return dist;
+	}
+
+	// sets each vector's nearest entry & its distance to it
+	auto vectors_assign(const std::vector<vector_t>& vectors, const std::vector<vector_t>& entries,
+		std::vector<int>& assigned, std::vector<float>& distances
+	) -> void {
+		aya::util::parallel_for(vectors.size(),[&](size_t begin, size_t end) {
+			for(size_t i=begin; i<end; i++) {
+				int best_entry = 0;
+				float best_dist = std::numeric_limits<float>::max();
+				for(size_t e=0; e<entries.size(); e++) {
+					const float dist = vector_distance(vectors[i],entries[e]);
+					if(dist < best_dist) {
+						best_dist = dist;
+						best_entry = e;
+					}
+				}
+				assigned[i] = best_entry;
+				distances[i] = best_dist;
+			}
+		});
+	}
+};
+
+aya::CVQCodebook::CVQCodebook(const std::vector<block_t>& blocks, int iterations)
+	: m_entries(),m_indices(blocks.size())
+{
+	// merge identical blocks ---------------------------@/
+	std::vector<size_t> order(blocks.size());
+	std::iota(order.begin(),order.end(),0);
+	std::sort(order.begin(),order.end(),[&](size_t a, size_t b) {
+		return block_less(blocks[a],blocks[b]);
+	});
+
+	std::vector<block_t> uniques;
+	std::vector<uint32_t> weights;
+	std::vector<uint32_t> block_unique(blocks.size());
+	for(auto i : order) {
+		if(uniques.empty() || !block_equals(uniques.back(),blocks[i])) {
+			uniques.push_back(blocks[i]);
+			weights.push_back(0);
+		}
+		weights.back()++;
+		block_unique[i] = uniques.size() - 1;
+	}
+
+	// few enough blocks to keep as-is ------------------@/
+	if(uniques.size() <= SIZE) {
+		std::copy(uniques.begin(),uniques.end(),m_entries.begin());
+		for(size_t i=0; i<blocks.size(); i++) {
+			m_indices[i] = block_unique[i];
+		}
+		return;
+	}
+
+	std::vector<vector_t> vectors(uniques.size());
+	for(size_t i=0; i<uniques.size(); i++) {
+		vectors[i] = block_toVector(uniques[i]);
+	}
+
+	// seed entries -------------------------------------@/
+	// spread evenly (by count) over the blocks sorted by brightness,
+	// so common colors start out with more of the entries.
+	std::vector<vector_t> entries(SIZE);
+	{
+		std::vector<float> brightness(vectors.size());
+		for(size_t i=0; i<vectors.size(); i++) {
+			brightness[i] = std::accumulate(vectors[i].begin(),vectors[i].end(),0.0f);
+		}
+		std::vector<size_t> by_brightness(vectors.size());
+		std::iota(by_brightness.begin(),by_brightness.end(),0);
+		std::stable_sort(by_brightness.begin(),by_brightness.end(),[&](size_t a, size_t b) {
+			return brightness[a] < brightness[b];
+		});
+
+		const uint64_t total_weight = blocks.size();
+		uint64_t weight_sum = 0;
+		size_t pos = 0;
+		for(size_t e=0; e<SIZE; e++) {
+			const uint64_t target = ((2*e + 1) * total_weight) / (2*SIZE);
+			while(pos+1 < by_brightness.size() && weight_sum + weights[by_brightness[pos]] <= target) {
+				weight_sum += weights[by_brightness[pos]];
+				pos++;
+			}
+			entries[e] = vectors[by_brightness[pos]];
+		}
+	}
+
+	// refine -------------------------------------------@/
+	std::vector<int> assigned(vectors.size(),-1);
+	std::vector<int> assigned_next(vectors.size());
+	std::vector<float> distances(vectors.size());
+
+	for(int iter=0; iter<iterations; iter++) {
+		vectors_assign(vectors,entries,assigned_next,distances);
+		if(assigned_next == assigned) break;
+		assigned.swap(assigned_next);
+
+		std::vector<std::array<double,VQ_DIMS>> sums(SIZE);
+		std::vector<uint64_t> counts(SIZE,0);
+		for(size_t i=0; i<vectors.size(); i++) {
+			auto& sum = sums[assigned[i]];
+			for(int d=0; d<VQ_DIMS; d++) sum[d] += double(vectors[i][d]) * weights[i];
+			counts[assigned[i]] += weights[i];
+		}
+
+		// entries nobody picked take over the worst-fitting blocks
+		std::vector<size_t> worst_fits;
+		size_t worst_next = 0;
+		for(size_t e=0; e<SIZE; e++) {
+			if(counts[e] > 0) {
+				for(int d=0; d<VQ_DIMS; d++) entries[e][d] = sums[e][d] / counts[e];
+				continue;
+			}
+			if(worst_fits.empty()) {
+				worst_fits.resize(vectors.size());
+				std::iota(worst_fits.begin(),worst_fits.end(),0);
+				std::stable_sort(worst_fits.begin(),worst_fits.end(),[&](size_t a, size_t b) {
+					return (distances[a] * weights[a]) > (distances[b] * weights[b]);
+				});
+			}
+			if(worst_next < worst_fits.size()) {
+				entries[e] = vectors[worst_fits[worst_next++]];
+			}
+		}
+	}
+
+	// snap entries to 8 bits, then pick against those --@/
+	for(size_t e=0; e<SIZE; e++) {
+		m_entries[e] = vector_toBlock(entries[e]);
+		entries[e] = block_toVector(m_entries[e]);
+	}
+	vectors_assign(vectors,entries,assigned,distances);
+	for(size_t i=0; i<blocks.size(); i++) {
+		m_indices[i] = assigned[block_unique[i]];
+	}
+}
+